@@ -14,6 +14,41 @@
 #include <limits>
 #include <algorithm>
 #include <vector>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <iterator>
+#include <functional>
+#include <memory>
+#include <complex>
+#include <cmath>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <climits>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
+#ifdef HPF_IO_URING
+#include <liburing.h>  // make IO_URING=1
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>  // zone map min/max
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define HPF_COROUTINES 1  // make STD=c++20 adds AsyncReader and hpf summary
+#include <coroutine>
+#include <latch>
+#endif
 #include "tinyxml2.h"  //  for reading/parsing xml
 #include "tixml2ex.h"  //  this also includes tinyxml2.h, but it's already loaded
 using namespace std;
@@ -39,6 +74,69 @@ std::string i2h( T i )
   return stream.str();
 }
 
+// minimal native-endian binary serialisation, used for the .hpfidx sidecar
+struct BinWriter
+{
+    string buf;
+    template< typename T >
+    void put(const T v) { buf.append(reinterpret_cast<const char*>(&v), sizeof(T)); }
+    void put_string(const string& s) { put(static_cast<int32_t>(s.size())); buf.append(s); }
+};
+
+struct BinReader
+{
+    const char* ptr;
+    const char* end;
+    bool ok = true;
+    BinReader(const char* p, size_t n) : ptr(p), end(p + n) { }
+    size_t left() const { return end - ptr; }  // bytes not yet read, to bound counts read from the data
+    template< typename T >
+    T get()
+    {
+        T v = T();
+        if (ptr + sizeof(T) > end) { ok = false; return v; }
+        memcpy(&v, ptr, sizeof(T));
+        ptr += sizeof(T);
+        return v;
+    }
+    string get_string()
+    {
+        auto n = get<int32_t>();
+        if (! ok || n < 0 || ptr + n > end) { ok = false; return string(); }
+        string s(ptr, n);
+        ptr += n;
+        return s;
+    }
+};
+
+template< typename T >
+struct Span
+{   // a view of n contiguous elements, usable with range-for and the standard algorithms
+    T*     ptr = nullptr;
+    size_t n   = 0;
+    T*     begin() const { return ptr; }
+    T*     end() const { return ptr + n; }
+    size_t size() const { return n; }
+    bool   empty() const { return n == 0; }
+    T&     operator[](const size_t i) const { return ptr[i]; }
+};
+
+string json_string(const string& s)
+{   // quote and escape a string for JSON output
+    stringstream ss;
+    ss << '"';
+    for (auto c : s) {
+        if (c == '"' || c == '\\')  ss << '\\' << c;
+        else if (c == '\n')         ss << "\\n";
+        else if (c == '\t')         ss << "\\t";
+        else if (static_cast<unsigned char>(c) < 0x20)
+            ss << "\\u" << std::setfill('0') << std::setw(4) << std::hex << static_cast<int>(c) << std::dec;
+        else                        ss << c;
+    }
+    ss << '"';
+    return ss.str();
+}
+
 string ToLower(const string& s)
 {
     string t = s;
@@ -46,14 +144,375 @@ string ToLower(const string& s)
     return t;
 }
 
+typedef struct ThermocoupleRange {
+    double         lo, hi;  // EMF range in mV
+    vector<double> d;       // polynomial coefficients d0, d1, ... giving degrees C
+} ThermocoupleRange;
+
+const vector<ThermocoupleRange>* thermocouple_polynomials(const string& type)
+{   // NIST ITS-90 inverse polynomials for thermocouple type K, J, T or E, named alone or as e.g. "Type K" in
+    // any case; nullptr for any other name, e.g. "None", whose channels are then output in volts
+    static const vector<ThermocoupleRange> K = {
+        { -5.891,  0.0,    { 0.0, 2.5173462e1, -1.1662878, -1.0833638, -8.9773540e-1, -3.7342377e-1,
+                             -8.6632643e-2, -1.0450598e-2, -5.1920577e-4 } },
+        {  0.0,    20.644, { 0.0, 2.508355e1, 7.860106e-2, -2.503131e-1, 8.315270e-2, -1.228034e-2,
+                             9.804036e-4, -4.413030e-5, 1.057734e-6, -1.052755e-8 } },
+        {  20.644, 54.886, { -1.318058e2, 4.830222e1, -1.646031, 5.464731e-2, -9.650715e-4, 8.802193e-6,
+                             -3.110810e-8 } } };
+    static const vector<ThermocoupleRange> J = {
+        { -8.095,  0.0,    { 0.0, 1.9528268e1, -1.2286185, -1.0752178, -5.9086933e-1, -1.7256713e-1,
+                             -2.8131513e-2, -2.3963370e-3, -8.3823321e-5 } },
+        {  0.0,    42.919, { 0.0, 1.978425e1, -2.001204e-1, 1.036969e-2, -2.549687e-4, 3.585153e-6,
+                             -5.344285e-8, 5.099890e-10 } },
+        {  42.919, 69.553, { -3.11358187e3, 3.00543684e2, -9.94773230, 1.70276630e-1, -1.43033468e-3,
+                             4.73886084e-6 } } };
+    static const vector<ThermocoupleRange> T = {
+        { -5.603,  0.0,    { 0.0, 2.5949192e1, -2.1316967e-1, 7.9018692e-1, 4.2527777e-1, 1.3304473e-1,
+                             2.0241446e-2, 1.2668171e-3 } },
+        {  0.0,    20.872, { 0.0, 2.592800e1, -7.602961e-1, 4.637791e-2, -2.165394e-3, 6.048144e-5,
+                             -7.293422e-7 } } };
+    static const vector<ThermocoupleRange> E = {
+        { -8.825,  0.0,    { 0.0, 1.6977288e1, -4.3514970e-1, -1.5859697e-1, -9.2502871e-2, -2.6084314e-2,
+                             -4.1360199e-3, -3.4034030e-4, -1.1564890e-5 } },
+        {  0.0,    76.373, { 0.0, 1.7057035e1, -2.3301759e-1, 6.5435585e-3, -7.3562749e-5, -1.7896001e-6,
+                             8.4036165e-8, -1.3735879e-9, 1.0629823e-11, -3.2447087e-14 } } };
+    auto b = type.find_first_not_of(" \t"), e = type.find_last_not_of(" \t");
+    string t = (b == string::npos) ? "" : ToLower(type.substr(b, e - b + 1));
+    if (t.size() == 6 && t.compare(0, 5, "type ") == 0)
+        t.erase(0, 5);
+    if (t == "k") return &K;
+    if (t == "j") return &J;
+    if (t == "t") return &T;
+    if (t == "e") return &E;
+    return nullptr;
+}
+
+double thermocouple_celsius(const vector<ThermocoupleRange>& r, const double mv)
+{   // degrees C for EMF mv with the reference junction at 0 C, NaN outside the polynomials' range
+    for (auto& x : r) {
+        if (mv < x.lo || mv > x.hi)
+            continue;
+        double t = 0.0;
+        for (auto i = x.d.size(); i > 0; --i)
+            t = t * mv + x.d[i - 1];
+        return t;
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
 
 
-// TODO   cannot currently handle more than one groupID, and...
-// TODO   cannot currently detect if there is more than one groupID in use, and...
-// TODO   does not currently detect if the channel info and data groupIDs match.  Address in reverse order.
+// DONE   cannot currently handle more than one groupID, and...
+// DONE   cannot currently detect if there is more than one groupID in use, and...
+// DONE   does not currently detect if the channel info and data groupIDs match.  Address in reverse order.
 // DONE   does not currently detect if there are multiple channelinfo blocks.
 
 
+class HPFFile;
+
+class DataSink
+{
+    ////
+    //// DataSink receives each data chunk after it is read into HPFFile::channeldata[], for output modes
+    //// other than the table.  finish() is called once all chunks have been read.  The helpers below keep
+    //// the bookkeeping every sink shares: its header line, gaps in datastartindex, and channel lengths
+    ////
+
+    public:
+
+        virtual ~DataSink() { }
+        virtual void chunk(HPFFile& h, const int64_t datastartindex, const int32_t n) = 0;
+        virtual void finish(HPFFile&) { }
+
+    protected:
+
+        bool    header_done = false;  // has the sink written its header?
+        int64_t expected    = -1;     // datastartindex expected of the next chunk, -1 before the first
+        int64_t gap_at      = -1;     // what expected was before the latest chunk
+
+        // does the chunk at dsi carry straight on from the previous one?  The first chunk does.  On a gap or
+        // an overlap the sink restarts whatever it carries across chunks; gap_at is where it was expected
+        bool follows(const HPFFile& h, const string& cnm, const int64_t dsi, const int32_t n);
+        // readings per second of channel ch, from PerChannelSampleRate or else TimeIncrement, 1 if neither is set
+        static double sample_rate(const HPFFile& h, const int32_t ch);
+        // exit unless each of chans has at least the n readings of the chunk's first channel
+        static void need_readings(const HPFFile& h, const vector<int32_t>& chans, const int32_t n, const char* hint);
+        static void need_readings(const HPFFile& h, const int32_t n, const char* hint);  // all channels
+};
+
+
+class ReadAhead
+{
+    ////
+    //// ReadAhead keeps depth reads of one window each in flight ahead of a reader working forward through a
+    //// file, so the device sees a deep queue while chunks are decoded.  Built with HPF_IO_URING (make
+    //// IO_URING=1) the reads are submitted to io_uring into registered buffers; without it, or when the
+    //// kernel refuses a ring, depth threads issue them with pread.  read() copies any byte range out of the
+    //// windows, moving the read-ahead forward past windows left behind; a range before them restarts it
+    ////
+
+    public:
+
+        const string cnm = "ReadAhead";
+        enum { window = 1024 * 1024 };  // bytes per read, aligned in the file
+
+        int64_t restarts = 0;  // jumps backwards or too far forwards
+        int64_t waits    = 0;  // windows not yet read when wanted
+
+    private:
+
+        typedef struct Slot {
+            char*   buf   = nullptr;
+            int64_t block = -1;     // the window of the file held or being read, at block * window
+            int64_t len   = 0;      // bytes read, once ready
+            bool    ready = false;
+        } Slot;
+
+        int           fd = -1;
+        int64_t       filesize;
+        int64_t       depth;
+        unsigned char debug;
+        vector<Slot>  slots;        // window b goes in slots[b % depth]
+        int64_t       first = 0;    // windows [first, first + depth) are read or being read
+        bool          started = false;
+
+        std::mutex              mutex;      // the pread threads' queue and the slots' ready flags
+        std::condition_variable cv;
+        std::deque<size_t>      queue;
+        int64_t                 busy = 0;   // pread threads reading a window
+        bool                    stop = false;
+        vector<std::thread>     readers;
+#ifdef HPF_IO_URING
+        io_uring                ring;
+        bool                    uring = false;
+        int64_t                 inflight = 0;
+#endif
+
+    public:
+
+        ReadAhead(const string& fn, const int64_t size, const unsigned d, const unsigned char dbg = 0)
+            : filesize(size), depth(std::max(d, 1u)), debug(dbg), slots(depth)
+        {
+            static const string p = cnm + ": ";
+            fd = ::open(fn.c_str(), O_RDONLY);
+            if (fd < 0) {
+                cerr << p << "*** cannot open " << fn << ": " << strerror(errno) << endl;
+                exit(1);
+            }
+            for (auto& s : slots)
+                if (posix_memalign(reinterpret_cast<void**>(&s.buf), 4096, window)) {
+                    cerr << p << "*** cannot allocate " << depth << " read-ahead windows" << endl;
+                    exit(1);
+                }
+#ifdef HPF_IO_URING
+            if (io_uring_queue_init(depth, &ring, 0) == 0) {
+                vector<iovec> iov(depth);
+                for (int64_t i = 0; i < depth; ++i)
+                    iov[i] = { slots[i].buf, window };
+                if (io_uring_register_buffers(&ring, iov.data(), depth) == 0)
+                    uring = true;
+                else
+                    io_uring_queue_exit(&ring);
+            }
+            if (debug)
+                cerr << p << depth << " windows of " << window << " bytes through " << (uring ? "io_uring" : "pread") << endl;
+            if (uring)
+                return;
+#else
+            if (debug)
+                cerr << p << depth << " windows of " << window << " bytes through pread" << endl;
+#endif
+            for (int64_t i = 0; i < depth; ++i)  // one per slot, so depth preads are in flight like the ring's reads
+                readers.emplace_back([this] { work(); });
+        }
+
+        ~ReadAhead()
+        {
+            drain();
+#ifdef HPF_IO_URING
+            if (uring)
+                io_uring_queue_exit(&ring);
+#endif
+            if (readers.size()) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stop = true;
+                }
+                cv.notify_all();
+                for (auto& t : readers)
+                    t.join();
+            }
+            for (auto& s : slots)
+                free(s.buf);
+            if (fd >= 0)
+                ::close(fd);
+            if (debug)
+                cerr << cnm << ": " << restarts << " restarts, waited for " << waits << " windows" << endl;
+        }
+
+        size_t read(const int64_t off, char* dst, size_t n)
+        {   // copy n bytes at off to dst, fewer at the end of the file; returns the bytes copied
+            if (off < 0 || off >= filesize)
+                return 0;
+            n = std::min<int64_t>(n, filesize - off);
+            size_t got = 0;
+            while (got < n) {
+                const int64_t at = off + got, b = at / window;
+                if (! started || b < first || b >= first + depth)
+                    restart(b);
+                while (first < b) {  // done with window first, read the one depth beyond it into its slot
+                    wait(first);
+                    issue(first + depth);
+                    ++first;
+                }
+                auto& s = slots[b % depth];
+                wait(b);
+                const int64_t in = at - b * window;
+                if (in >= s.len)
+                    break;  // the file is shorter than when we started
+                const size_t k = std::min<int64_t>(n - got, s.len - in);
+                memcpy(dst + got, s.buf + in, k);
+                got += k;
+            }
+            return got;
+        }
+
+    private:
+
+        void restart(const int64_t b)
+        {
+            drain();
+            if (started)
+                ++restarts;
+            started = true;
+            first = b;
+            for (int64_t i = 0; i < depth; ++i)
+                issue(b + i);
+        }
+
+        void issue(const int64_t b)
+        {   // start reading window b, if the file reaches it
+            auto& s = slots[b % depth];
+            s.block = b;
+            s.len = 0;
+            s.ready = false;
+            if (b * window >= filesize) {
+                s.ready = true;
+                return;
+            }
+#ifdef HPF_IO_URING
+            if (uring) {
+                const int64_t len = std::min<int64_t>(window, filesize - b * window);
+                io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_read_fixed(sqe, fd, s.buf, len, b * window, b % depth);
+                io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(b % depth)));
+                io_uring_submit(&ring);
+                ++inflight;
+                return;
+            }
+#endif
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(b % depth);
+            cv.notify_all();
+        }
+
+        void complete(Slot& s, int64_t got)
+        {   // got bytes arrived in s; a short read before the end of the file is finished here
+            static const string p = cnm + ": ";
+            const int64_t off = s.block * window, len = std::min<int64_t>(window, filesize - off);
+            while (got >= 0 && got < len) {
+                auto r = pread(fd, s.buf + got, len - got, off + got);
+                if (r < 0 && errno == EINTR)
+                    continue;
+                if (r <= 0)
+                    break;
+                got += r;
+            }
+            if (got < 0) {
+                cerr << p << "*** read at " << i2h(off) << " failed: " << strerror(-got) << endl;
+                exit(1);
+            }
+            s.len = got;
+            s.ready = true;
+        }
+
+        void wait(const int64_t b)
+        {   // until window b is read
+            auto& s = slots[b % depth];
+#ifdef HPF_IO_URING
+            if (uring) {
+                if (! s.ready)
+                    ++waits;
+                while (! s.ready)
+                    reap();
+                return;
+            }
+#endif
+            std::unique_lock<std::mutex> lock(mutex);
+            if (! s.ready)
+                ++waits;
+            cv.wait(lock, [&s] { return s.ready; });
+        }
+
+#ifdef HPF_IO_URING
+        void reap()
+        {   // wait for one completion
+            static const string p = cnm + ": ";
+            io_uring_cqe* cqe = nullptr;
+            int r = io_uring_wait_cqe(&ring, &cqe);
+            if (r < 0) {
+                cerr << p << "*** io_uring_wait_cqe: " << strerror(-r) << endl;
+                exit(1);
+            }
+            auto i = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+            int64_t res = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+            --inflight;
+            complete(slots[i], res);
+        }
+#endif
+
+        void drain()
+        {   // until no read is in flight
+#ifdef HPF_IO_URING
+            if (uring) {
+                while (inflight)
+                    reap();
+                return;
+            }
+#endif
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return queue.empty() && ! busy; });
+        }
+
+        void work()
+        {   // a pread thread: read queued slots' windows, taken in order
+            for (;;) {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return stop || ! queue.empty(); });
+                    if (queue.empty())
+                        return;
+                    i = queue.front();
+                    queue.pop_front();
+                    ++busy;
+                }
+                Slot tmp;
+                tmp.block = slots[i].block;
+                tmp.buf = slots[i].buf;
+                complete(tmp, 0);
+                std::lock_guard<std::mutex> lock(mutex);
+                slots[i].len = tmp.len;
+                slots[i].ready = true;
+                --busy;
+                cv.notify_all();
+            }
+        }
+};
+
+
+
 class HPFFile
 {
     ////
@@ -72,7 +531,12 @@ class HPFFile
         streampos     filesize;                  // size of the file opened, set by the constructor
         int64_t       data_lines        = 0;     // number of data lines
         int64_t       table_data_lines  = 0;     // number of data lines in the table
+        bool          table_header_done = false; // has the table header been printed?
         bool          include_data_line = false; // prefix output lines with data line?
+        bool          use_sidecar       = true;  // read/write the .hpfidx sidecar in read_info()
+        unsigned      scan_threads      = 0;     // threads for scan_index(), 0 means one per hardware thread
+        string        index_source      = "none";// where index[] came from: "none", "chunk" or "scan"
+        unsigned      read_ahead        = 0;     // windows read ahead of sequential read_chunk() by a ReadAhead, 0 reads directly
 #define DEFAULT_SEP "\t"
 
         ////
@@ -90,6 +554,7 @@ class HPFFile
 
         ifstream      file;
         const string  filename;
+        std::unique_ptr<ReadAhead> ahead;
         size_t        pos;
         streampos     curchunkfilepos;
         size_t        curchunksz;
@@ -101,7 +566,7 @@ class HPFFile
             int8_t  buffer8  [int8_count];
         } u;
 
-        string pfx(const string& p, const int w = 36)  // standardised prefix for debug output lines
+        string pfx(const string& p, const int w = 36) const  // standardised prefix for debug output lines
         {
             stringstream s;
             s.width(w);
@@ -256,9 +721,160 @@ class HPFFile
             double interpret_as_volts(int16_t p) const {
                 return static_cast<double>(p) * DataScale + DataOffset;
             }
+            // conversion of counts for output, chosen by set_conversion(): volts, or for engineering
+            // units counts -> volts -> sensor units fused into one scale and offset, or for thermocouples
+            // a table of the temperature for every count
+            double   out_scale  = 0.0;
+            double   out_offset = 0.0;
+            string   out_unit;
+            std::shared_ptr<const vector<double>> lut;  // indexed by count + 32768
+            double interpret(int16_t p) const {
+                return lut ? (*lut)[p + 32768] : static_cast<double>(p) * out_scale + out_offset;
+            }
+            double interpret_at(double p) const {  // for a fractional count
+                if (! lut)
+                    return p * out_scale + out_offset;
+                double i = std::min(std::max(floor(p), -32768.0), 32766.0);
+                auto k = static_cast<size_t>(i + 32768);
+                return (*lut)[k] + (p - i) * ((*lut)[k + 1] - (*lut)[k]);
+            }
+            bool set_conversion(const bool eng) {  // false if a thermocouple type is unknown
+                out_scale = DataScale;
+                out_offset = DataOffset;
+                out_unit = Unit;
+                lut.reset();
+                if (! eng)
+                    return true;
+                if (UseThermocoupleValues) {
+                    auto poly = thermocouple_polynomials(ThermocoupleType);
+                    if (! poly)
+                        return false;
+                    auto u = ToLower(TemperatureUnit);
+                    bool f = u.size() && u[0] == 'f', k = u.size() && u[0] == 'k';
+                    auto t = std::make_shared<vector<double>>(65536);
+                    for (int32_t c = -32768; c <= 32767; ++c) {
+                        double v = thermocouple_celsius(*poly, interpret_as_volts(c) * 1000.0);
+                        (*t)[c + 32768] = f ? v * 1.8 + 32.0 : k ? v + 273.15 : v;
+                    }
+                    lut = t;
+                    out_unit = f ? "degF" : k ? "K" : "degC";
+                } else if (UsesSensorValues) {
+                    out_scale = DataScale * SensorScale;
+                    out_offset = DataOffset * SensorScale + SensorOffset;
+                }
+                return true;
+            }
         } ChannelInfo;
         vector<ChannelInfo> channelinfo;
 
+        // time column for the table, computed from a channel's StartTime and TimeIncrement.  Times are
+        // held as integer ticks of 10^-digits seconds; the date-to-minute prefix is rebuilt only when the
+        // minute changes, and each row rewrites just the seconds and fraction digits in place
+        typedef struct TimeColumn {
+            enum { none, absolute, relative, epoch };
+            int     mode        = none;
+            int     digits      = 0;       // fractional digits written
+            int64_t pow10       = 1;
+            int64_t start_ticks = 0;       // ticks since 1970-01-01 00:00:00 of sample 0
+            double  inc_ticks   = 0.0;     // ticks per sample
+            int64_t minute      = std::numeric_limits<int64_t>::min();  // minute held in prefix
+            char    buf[64];
+            size_t  prefix_len  = 0;
+
+            static int64_t days_from_civil(int64_t y, const unsigned m, const unsigned d)
+            {   // days since 1970-01-01 in the proleptic Gregorian calendar, from Howard Hinnant's date algorithms
+                y -= m <= 2;
+                const int64_t era = (y >= 0 ? y : y - 399) / 400;
+                const unsigned yoe = static_cast<unsigned>(y - era * 400);
+                const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+                const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+                return era * 146097 + static_cast<int64_t>(doe) - 719468;
+            }
+            static void civil_from_days(int64_t z, int64_t& y, unsigned& m, unsigned& d)
+            {
+                z += 719468;
+                const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+                const unsigned doe = static_cast<unsigned>(z - era * 146097);
+                const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+                const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+                const unsigned mp = (5 * doy + 2) / 153;
+                d = doy - (153 * mp + 2) / 5 + 1;
+                m = mp < 10 ? mp + 3 : mp - 9;
+                y = static_cast<int64_t>(yoe) + era * 400 + (m <= 2);
+            }
+            static char* put_digits(char* p, int64_t v, const int width)
+            {   // v as exactly width digits, zero-padded
+                for (auto i = width - 1; i >= 0; --i, v /= 10)
+                    p[i] = '0' + v % 10;
+                return p + width;
+            }
+            static char* put_int(char* p, int64_t v)
+            {
+                char t[24];
+                int n = 0;
+                if (v < 0) { *p++ = '-'; v = -v; }
+                do { t[n++] = '0' + v % 10; v /= 10; } while (v);
+                while (n) *p++ = t[--n];
+                return p;
+            }
+
+            void setup(const int m, const Time& start, const double increment)
+            {
+                mode = m;
+                auto dot = start.s_time.find('.');
+                int sdigits = (dot == string::npos) ? 0 : start.s_time.size() - dot - 1;
+                int idigits = 0;
+                for (double x = increment; idigits < 9 && std::abs(x - llround(x)) > 1e-6 * std::max(1.0, x); x *= 10)
+                    ++idigits;
+                digits = std::min(9, std::max(sdigits, idigits));
+                pow10 = 1;
+                for (auto i = 0; i < digits; ++i)
+                    pow10 *= 10;
+                int64_t frac = start.x;
+                for (auto i = sdigits; i < digits; ++i)
+                    frac *= 10;
+                for (auto i = digits; i < sdigits; ++i)
+                    frac /= 10;
+                start_ticks = (days_from_civil(start.y, start.m, start.d) * 86400 + start.h * 3600 + start.n * 60 + start.s) * pow10 + frac;
+                inc_ticks = increment * pow10;
+                minute = std::numeric_limits<int64_t>::min();
+            }
+
+            const char* format(const int64_t sample, size_t& len)
+            {
+                int64_t rel = llround(sample * inc_ticks);
+                char* p;
+                if (mode == absolute) {
+                    int64_t t = start_ticks + rel, secs = t / pow10;
+                    if (secs / 60 != minute) {
+                        minute = secs / 60;
+                        int64_t y;
+                        unsigned mo, d;
+                        civil_from_days(minute / 1440, y, mo, d);
+                        p = put_digits(buf, y, 4); *p++ = '-';
+                        p = put_digits(p, mo, 2);  *p++ = '-';
+                        p = put_digits(p, d, 2);   *p++ = ' ';
+                        p = put_digits(p, (minute / 60) % 24, 2); *p++ = ':';
+                        p = put_digits(p, minute % 60, 2);        *p++ = ':';
+                        prefix_len = p - buf;
+                    }
+                    p = put_digits(buf + prefix_len, secs % 60, 2);
+                    rel = t;
+                } else {
+                    if (mode == epoch)
+                        rel += start_ticks;
+                    p = put_int(buf, rel / pow10);
+                }
+                if (digits) {
+                    *p++ = '.';
+                    p = put_digits(p, rel % pow10, digits);
+                }
+                len = p - buf;
+                return buf;
+            }
+        } TimeColumn;
+        TimeColumn timecol;
+
         // data block
         typedef struct ChannelDescriptor {
             int32_t _index;      // not defined as part of the ChannelDescriptor structure
@@ -288,7 +904,32 @@ class HPFFile
             vector<int16_t> data;
         } ChannelData;
         vector<ChannelData> channeldata;
-        
+
+        // channel groups: each channelinfo chunk defines a group.  The active group's channel info,
+        // data and table state are the members above, so all decoding works on them unchanged;
+        // the other groups wait in groups[] until a data chunk for them arrives, see select_group()
+        typedef struct Group {
+            int32_t                  groupid           = 0;
+            int32_t                  numberofchannels  = 0;
+            vector<ChannelInfo>      channelinfo;
+            vector<ChannelData>      channeldata;
+            int64_t                  data_lines        = 0;
+            int64_t                  table_data_lines  = 0;
+            bool                     table_header_done = false;
+            TimeColumn               timecol;
+            ostream*                 out               = &cout;
+            std::shared_ptr<ostream> file;       // owned output when splitting groups
+        } Group;
+        vector<Group>            groups;         // one per channelinfo chunk, in file order; groups[active_group] is a placeholder
+        size_t                   active_group      = 0;
+        int32_t                  first_groupid     = 0;
+        int64_t                  only_group        = -1;  // if >= 0, decode only data chunks of this group
+        string                   split_prefix;             // if set, write each group's table to <split_prefix>group<id>.txt
+        bool                     eng_units         = false;  // output sensor units and temperatures rather than volts
+        ostream*                 table_out         = &cout;  // where the active group's table goes
+        std::shared_ptr<ostream> table_file;
+        bool                     groups_warned     = false;
+
 
         // eventdefinition block
         int32_t definitioncount;
@@ -371,6 +1012,54 @@ class HPFFile
         } Index;
         vector<Index> index;
 
+        // zone map, the min and max count of each channel in each indexed data chunk, in
+        // zonemap[index_entry * numberofchannels + channel]; empty until build_zonemap()
+        typedef struct ZoneMap {
+            int16_t min;
+            int16_t max;
+        } ZoneMap;
+        vector<ZoneMap> zonemap;
+
+        // the counts [lo, hi] for which a channel's volts satisfy a comparison; empty if lo > hi
+        typedef struct CountRange {
+            int32_t lo;
+            int32_t hi;
+            bool empty() const { return lo > hi; }
+            bool test(const int16_t c) const { return lo <= c && c <= hi; }
+            bool overlaps(const ZoneMap& z) const { return lo <= z.max && z.min <= hi; }
+        } CountRange;
+
+        int64_t last_datastartindex = 0;  // datastartindex of the most recently interpreted data chunk
+        vector<DataSink*> sinks;          // receive each data chunk after the table; not owned
+        vector<DataSink*> pre_sinks;      // receive each data chunk before filtering and the table, and may change channeldata[]; not owned
+
+        // row filter compiled from an expression like 'Ch3 > 2.5 && Ch4 < 0' by compile_filter(); comparisons
+        // become CountRanges so rows are tested on raw counts without scaling
+        typedef struct FilterNode {
+            enum { leaf, op_and, op_or, op_not } op;
+            int32_t    ch;    // leaf: channel
+            CountRange r;     // leaf: counts that satisfy the comparison
+            int32_t    a, b;  // op_*: operand nodes
+        } FilterNode;
+        vector<FilterNode> filter;   // root is filter.back(); empty means no filter
+        vector<uint8_t>    row_mask; // filter result for each row of the current data chunk
+
+        // derived channels, compiled once from --derive definitions into a program over whole columns
+        // and evaluated for each data chunk into Derived::data, which the table appends as columns
+        typedef struct DeriveNode {
+            enum { channel, derived, constant, op_add, op_sub, op_mul, op_div, op_neg, fn_abs, fn_sqrt } op;
+            int32_t ch;    // channel: channel number; derived: index of an earlier derived channel
+            double  v;     // constant
+            int32_t a, b;  // op_*, fn_*: operand nodes
+        } DeriveNode;
+        typedef struct Derived {
+            string             name;
+            vector<DeriveNode> prog;  // root is prog.back(), operands always precede their operators
+            vector<double>     data;  // values for the rows of the current data chunk
+        } Derived;
+        vector<Derived> derived;
+        enum { zone_none, zone_some, zone_all };
+
 
     public:
 
@@ -397,8 +1086,8 @@ class HPFFile
         ////
         //// public methods for reading and interpreting chunk contents
         ////
-        bool read_chunk()
-        {
+        bool read_chunk(const bool direct = false)
+        {   // direct skips the read-ahead, for reads through the index that jump about the file
             static const string p = pfx(cnm + "::" + "read_chunk", 25);
             if (file_status() == false)
                 return false;
@@ -408,12 +1097,24 @@ class HPFFile
             // interpret_chunk()
             int64_t twowords[2];
             streampos here = file.tellg();
-            file.read(reinterpret_cast<char*>(&twowords[0]), 16);  // read the first two words
-            if (! file) {
-                if (debug)
-                    cerr << p << "could only read " << file.gcount() << " bytes, closing file" << endl;
-                file.close();
-                return false;
+            if (read_ahead && ! ahead && ! direct)
+                ahead.reset(new ReadAhead(filename, filesize, read_ahead, debug));
+            if (ahead && ! direct) {  // the file is only used for its position
+                auto got = ahead->read(here, reinterpret_cast<char*>(&twowords[0]), 16);
+                if (got < 16) {
+                    if (debug)
+                        cerr << p << "could only read " << got << " bytes, closing file" << endl;
+                    file.close();
+                    return false;
+                }
+            } else {
+                file.read(reinterpret_cast<char*>(&twowords[0]), 16);  // read the first two words
+                if (! file) {
+                    if (debug)
+                        cerr << p << "could only read " << file.gcount() << " bytes, closing file" << endl;
+                    file.close();
+                    return false;
+                }
             }
             if (debug >= 2) {
                 cerr << p << "here=" << here << " " << i2h(here)
@@ -429,7 +1130,24 @@ class HPFFile
                 exit(1);
             }
             curchunkfilepos = here;
-            file.read(reinterpret_cast<char*>(&u.buffer64[0]), curchunksz);  // read into the buffer
+            if (ahead && ! direct) {
+                auto got = ahead->read(here, reinterpret_cast<char*>(&u.buffer64[0]), curchunksz);
+                if (got < curchunksz) {  // a chunk cut short by the end of the file
+                    if (debug)
+                        cerr << p << "could only read " << got << " bytes, closing file" << endl;
+                    file.close();
+                    return false;
+                }
+                file.seekg(here + static_cast<streamoff>(curchunksz));
+            } else {
+                file.read(reinterpret_cast<char*>(&u.buffer64[0]), curchunksz);  // read into the buffer
+                if (! file) {
+                    if (debug)
+                        cerr << p << "could only read " << file.gcount() << " bytes, closing file" << endl;
+                    file.close();
+                    return false;
+                }
+            }
             pos = file.tellg();
             if (debug)
                 file_status();
@@ -437,6 +1155,173 @@ class HPFFile
             return true;
         }
 
+        bool read_chunk_at(const streampos& off)
+        {   // reposition to a known chunk boundary and read the chunk there, directly: a read-ahead would be
+            // restarted, and its windows in flight drained, at every chunk the index skips
+            file.clear();
+            file.seekg(off);
+            return read_chunk(true);
+        }
+
+        bool peek_chunk(int64_t& id, int64_t& size)
+        {   // read the chunkid and chunksize of the next chunk without moving the file position
+            if (! file.is_open())
+                return false;
+            int64_t twowords[2];
+            streampos here = file.tellg();
+            file.read(reinterpret_cast<char*>(&twowords[0]), 16);
+            if (! file) {
+                file.clear();
+                file.seekg(here);
+                return false;
+            }
+            file.seekg(here);
+            id = twowords[0];
+            size = twowords[1];
+            return true;
+        }
+
+        bool read_leading()
+        {   // read the header, channelinfo and eventdefinition chunks that precede the first data chunk
+            static const string p = pfx(cnm + "::" + "read_leading", 25);
+            int64_t id, size;
+            while (peek_chunk(id, size) && id != chunkid_data && id != chunkid_eventdata && id != chunkid_index) {
+                if (! read_chunk())
+                    return false;
+            }
+            if (! channelinfo.size()) {
+                cerr << p << "*** no channelinfo chunk found before the first data chunk" << endl;
+                return false;
+            }
+            return use_group();
+        }
+
+        int group_slot(const int32_t gid) const
+        {   // the groups[] slot holding group gid, or -1 if no channelinfo chunk has defined it
+            if (gid == groupid && channelinfo.size())  // channelinfo may also have come from the sidecar
+                return active_group;
+            for (size_t i = 0; i < groups.size(); ++i)
+                if (i != active_group && groups[i].groupid == gid)
+                    return i;
+            return -1;
+        }
+
+        void swap_group(Group& g)
+        {
+            std::swap(groupid, g.groupid);
+            std::swap(numberofchannels, g.numberofchannels);
+            channelinfo.swap(g.channelinfo);
+            channeldata.swap(g.channeldata);
+            std::swap(data_lines, g.data_lines);
+            std::swap(table_data_lines, g.table_data_lines);
+            std::swap(table_header_done, g.table_header_done);
+            std::swap(timecol, g.timecol);
+            std::swap(table_out, g.out);
+            table_file.swap(g.file);
+        }
+
+        void activate_slot(const size_t s)
+        {   // park the active group's state in its slot, and take slot s's state, leaving the placeholder there
+            if (s == active_group)
+                return;
+            swap_group(groups[active_group]);
+            swap_group(groups[s]);
+            active_group = s;
+        }
+
+        bool select_group(const int32_t gid)
+        {
+            auto s = group_slot(gid);
+            if (s < 0)
+                return false;
+            activate_slot(s);
+            return true;
+        }
+
+        bool use_group()
+        {   // after reading the metadata, make the group chosen with only_group (else the first) active
+            static const string p = pfx(cnm + "::" + "use_group", 25);
+            int32_t gid = only_group >= 0 ? only_group : first_groupid;
+            if (groups.empty() ? gid == groupid : select_group(gid))
+                return true;
+            cerr << p << "*** no channelinfo chunk for group " << gid << ", groups are " << group_ids() << endl;
+            return false;
+        }
+
+        bool group_wanted(const int32_t gid)
+        {   // is the data of group gid to be decoded?
+            static const string p = pfx(cnm + "::" + "group_wanted", 25);
+            if (only_group >= 0)
+                return gid == only_group;
+            if (split_prefix.size())
+                return true;
+            if (gid != first_groupid && ! groups_warned) {
+                cerr << p << "file has more than one channel group, only group " << first_groupid
+                    << " is output; use --group or --split for the others" << endl;
+                groups_warned = true;
+            }
+            return gid == first_groupid;
+        }
+
+        string group_ids(const string sep = ",") const
+        {
+            stringstream ss;
+            if (groups.empty())
+                ss << groupid;
+            for (size_t i = 0; i < groups.size(); ++i)
+                ss << (i ? sep : "") << (i == active_group ? groupid : groups[i].groupid);
+            return ss.str();
+        }
+
+        void set_conversions()
+        {
+            static const string p = pfx(cnm + "::" + "set_conversions", 25);
+            for (auto& c : channelinfo)
+                if (! c.set_conversion(eng_units))
+                    cerr << p << "no conversion for thermocouple type '" << c.ThermocoupleType << "' of channel "
+                        << c.Name << ", output in volts" << endl;
+        }
+
+        void open_group_output()
+        {   // with split_prefix, the active group's table goes to its own file
+            static const string p = pfx(cnm + "::" + "open_group_output", 25);
+            if (split_prefix.empty())
+                return;
+            string fn = split_prefix + "group" + std::to_string(groupid) + ".txt";
+            auto f = std::make_shared<ofstream>(fn);
+            if (! *f) {
+                cerr << p << "*** Cannot open " << fn << endl;
+                exit(1);
+            }
+            table_file = f;
+            table_out = f.get();
+        }
+
+        bool read_info()
+        {   // read only the metadata: leading header/channelinfo/eventdefinition chunks, then the index via indexchunkoffset
+            static const string p = pfx(cnm + "::" + "read_info", 25);
+            if (use_sidecar && load_sidecar())
+                return use_group();
+            int64_t id, size;
+            if (! read_leading())
+                return false;
+            if (indexchunkoffset > 0 && indexchunkoffset < filesize) {
+                file.clear();
+                file.seekg(indexchunkoffset);
+                while (peek_chunk(id, size) && id == chunkid_index)  // index chunks may follow one another
+                    read_chunk();
+                if (index.size())
+                    index_source = "chunk";
+            } else if (debug) {
+                cerr << p << "indexchunkoffset " << i2h(indexchunkoffset) << " does not point into the file, no index read" << endl;
+            }
+            if (! index.size())
+                scan_index();
+            if (use_sidecar)
+                write_sidecar();
+            return true;
+        }
+
         void interpret_chunk()
         {
             static const string p = pfx(cnm + "::" + "interpret_chunk");
@@ -504,7 +1389,21 @@ class HPFFile
         void interpret_chunk_channelinfo()
         {
             static const string p = pfx(cnm + "::" + "interpret_chunk_channelinfo");
-            groupid = u.buffer32[4];
+            int32_t gid = u.buffer32[4];
+            if (groups.empty()) {
+                groups.emplace_back();  // placeholder for the active group
+                first_groupid = gid;
+            } else {
+                if (group_slot(gid) >= 0) {
+                    cerr << p << "*** second channelinfo chunk for groupid " << gid << endl;
+                    exit(1);
+                }
+                Group g;
+                g.timecol.mode = timecol.mode;
+                groups.push_back(std::move(g));
+                activate_slot(groups.size() - 1);
+            }
+            groupid = gid;
             numberofchannels = u.buffer32[5];
             xmldata.assign(reinterpret_cast<const char*>(&u.buffer32[6]));
             if (debug) {
@@ -522,10 +1421,6 @@ class HPFFile
                 cerr << p << "*** <" << rootname << "> not found in doc, instead found " << root->Name() << endl;
                 exit(1);
             }
-            if (channelinfo.size()) {
-                cerr << p << "*** channelinfo already allocated, has size " << channelinfo.size() << endl;
-                exit(1);
-            }
             channelinfo.resize(numberofchannels);
             channeldata.resize(numberofchannels);
             auto i = 0 * numberofchannels;
@@ -605,17 +1500,27 @@ class HPFFile
                     cerr << c.Name << ":" << c.DataType << ", ";
                 cerr << endl;
             }
+            set_conversions();
+            open_group_output();
         }
 
         void interpret_chunk_data()
         {
             static const string p = pfx(cnm + "::" + "interpret_chunk_data");
-            if (u.buffer32[4] != groupid) {
-                cerr << p << "*** groupid as recorded in data chunk " << u.buffer32[4] << " does not match groupid as recorded in channelinfo " << groupid << endl;
+            int32_t gid = u.buffer32[4];
+            if (group_slot(gid) < 0) {
+                cerr << p << "*** groupid as recorded in data chunk " << gid << " has no channelinfo, groups are " << group_ids() << endl;
                 exit(1);
             }
+            if (! group_wanted(gid))
+                return;
+            select_group(gid);
             int64_t datastartindex = *(reinterpret_cast<int64_t*>(&u.buffer32[5]));
             int32_t channeldatacount = u.buffer32[7];
+            if (channeldatacount > numberofchannels) {
+                cerr << p << "*** data chunk has " << channeldatacount << " channels, group " << groupid << " has " << numberofchannels << endl;
+                exit(1);
+            }
             vector<ChannelDescriptor> channeldescriptor(channeldatacount);
             for (auto i = 0; i < channeldatacount; ++i) {
                 channeldescriptor[i]._index = i;
@@ -664,8 +1569,18 @@ class HPFFile
                     cerr << endl;
                 }
             }
+            last_datastartindex = datastartindex;
+            for (auto sink : pre_sinks)
+                sink->chunk(*this, datastartindex, channeldescriptor[0]._num_atoms);
+            if (filter.size())
+                filter_rows(channeldescriptor[0]._num_atoms);
+            if (derived.size())
+                derive_rows(channeldescriptor[0]._num_atoms);
             // Output the lines of data we read
-            cout << table_from_data_csv(channeldescriptor);
+            if (table)
+                *table_out << table_from_data_csv(channeldescriptor);
+            for (auto sink : sinks)
+                sink->chunk(*this, datastartindex, channeldescriptor[0]._num_atoms);
             // Clear channeldata[].data
             for (auto c : channeldata) {
                 c.data.clear();
@@ -971,6 +1886,14 @@ class HPFFile
             file_status(true);
         }
 
+        void finish_sinks()
+        {
+            for (auto sink : pre_sinks)
+                sink->finish(*this);
+            for (auto sink : sinks)
+                sink->finish(*this);
+        }
+
         void summarise_data()
         {
             static const string p = pfx(cnm + "::" + "summarise_data", 20);
@@ -988,99 +1911,4717 @@ class HPFFile
             }
         }
 
-        string table_header_csv(bool minimal = false, const string sep = DEFAULT_SEP) const
-        {
-            stringstream ss;
-            if (! minimal) {
-                ss << "RecordingDate :" << sep << recdate << endl
-                    << "FromSample(TimeOfDay):" << sep << "xx:xx:xx.xxx" << endl
-                    << "ToSample(TimeOfDay):" << sep << "yy:yy:yy.yyy" << endl
-                    << "" << sep << "" << endl
-                    << "Channels Recorded " << sep << "" << numberofchannels << endl
-                    << "PerChannelSamplingFreq :" << sep << "" << setprecision(15) << channelinfo[0].PerChannelSampleRate << endl;
-                if (do_downsample) {
-                    ss << "DownsampleCount :" << sep << "" << downsample_count << endl;
+        ////
+        //// index reconstruction by scanning chunk headers, for files without an index chunk
+        ////
+        static const int64_t scan_split_min = 64 * 1024 * 1024;  // without scan_threads, only split the scan above this file size
+
+        typedef struct ScanEntry {
+            int64_t datastartindex;
+            int64_t perchanneldatalengthinsamples;
+            int64_t groupid;
+            int64_t fileoffset;
+        } ScanEntry;
+
+        bool scan_chunk_header(ifstream& f, const int64_t off, int64_t& id, int64_t& size) const
+        {   // read the 16-byte chunkid/chunksize at off and check they are plausible
+            int64_t twowords[2];
+            f.clear();
+            f.seekg(off);
+            f.read(reinterpret_cast<char*>(&twowords[0]), 16);
+            if (! f)
+                return false;
+            id = twowords[0];
+            size = twowords[1];
+            switch (id) {
+                case chunkid_header: case chunkid_channelinfo: case chunkid_data:
+                case chunkid_eventdefinition: case chunkid_eventdata: case chunkid_index:
+                    break;
+                default:
+                    return false;
+            }
+            return size > 16 && size <= static_cast<int64_t>(buffersz) && off + size <= filesize;
+        }
+
+        int64_t scan_resync(ifstream& f, const int64_t from, const int64_t to) const
+        {   // find the first offset in [from, to) holding a chunk header whose successor is also a chunk header (or EOF)
+            static const size_t blocksz = 64 * 1024;
+            vector<char> block(blocksz + 16);
+            int64_t id, size, id2, size2;
+            for (int64_t b = from; b < to; b += blocksz) {
+                f.clear();
+                f.seekg(b);
+                f.read(&block[0], block.size());
+                int64_t got = f.gcount();
+                for (int64_t i = 0; i + 16 <= got && b + i < to; ++i) {
+                    int64_t w[2];
+                    memcpy(&w[0], &block[i], 16);
+                    if (w[0] < chunkid_header || w[0] > chunkid_index || (w[0] & 0xfff) || w[1] <= 16)
+                        continue;  // cheap rejection before touching the file again
+                    int64_t off = b + i;
+                    if (! scan_chunk_header(f, off, id, size))
+                        continue;
+                    if (off + size == filesize || scan_chunk_header(f, off + size, id2, size2))
+                        return off;
                 }
-                ss << "" << sep << "" << endl;
-                // channelinfo
-                ss << "ChannelName" << sep << "ChannelNumber" << sep << "Units" << sep << "DataType" << sep 
-                    << "RangeMin" << sep << "RangeMax" << sep << "DataScale" << sep << "DataOffset" << sep
-                    << "SensorScale" << sep << "SensorOffset" << endl;
-                for (auto c : channelinfo) {
-                    ss << c.Name
-                        << sep << c.DataIndex
-                        << sep << c.Unit
-                        << sep << c.DataType
-                        << sep << c.RangeMin
-                        << sep << c.RangeMax
-                        << sep << c.DataScale
-                        << sep << c.DataOffset
-                        << sep << c.SensorScale
-                        << sep << c.SensorOffset
-                        << endl;
+            }
+            return -1;
+        }
+
+        void scan_range(const int64_t beg, const int64_t end, vector<ScanEntry>& out, int64_t& first, int64_t& stop) const
+        {   // follow the chunk chain starting within [beg, end), collecting data chunk entries that start in the range;
+            // first is where the chain was picked up (-1 if nowhere) and stop where it left the range
+            ifstream f(filename, ios::in | ios::binary);
+            int64_t off = first = (beg == 0) ? 0 : scan_resync(f, beg, end);
+            int32_t atom = DataType(channelinfo[0].DataType).size_bytes;
+            int64_t id, size;
+            while (off >= 0 && off < end && scan_chunk_header(f, off, id, size)) {
+                if (id == chunkid_data) {
+                    int32_t w[6];  // groupid, datastartindex (2 words), channeldatacount, offset[0], length[0]
+                    f.read(reinterpret_cast<char*>(&w[0]), sizeof(w));
+                    if (! f)
+                        break;
+                    out.push_back({ *reinterpret_cast<int64_t*>(&w[1]), w[5] / atom, w[0], off });
                 }
-                ss << "" << sep << "" << endl;
-                if (include_data_line)
-                    ss << "data_line" << sep;
+                off += size;
             }
-            for (auto i = 0; i < numberofchannels; ++i) {
-                ss << channelinfo[i].Name;
-                if (i < numberofchannels - 1)
+            stop = off;
+        }
+
+        void scan_index()
+        {   // rebuild index[] from chunk headers, splitting large files across threads by byte range
+            static const string p = pfx(cnm + "::" + "scan_index", 25);
+            if (! channelinfo.size()) { cerr << p << "*** channelinfo must be read before scanning" << endl; exit(1); }
+            unsigned nthreads = scan_threads ? scan_threads : std::max(1u, std::thread::hardware_concurrency());
+            if (! scan_threads && filesize < scan_split_min)  // an explicit --threads splits any file
+                nthreads = 1;
+            vector<vector<ScanEntry>> parts(nthreads);
+            vector<int64_t> ends(nthreads), firsts(nthreads), stops(nthreads);
+            vector<std::thread> threads;
+            int64_t step = static_cast<int64_t>(filesize) / nthreads;
+            for (unsigned t = 0; t < nthreads; ++t) {
+                int64_t b = t * step;
+                ends[t] = (t == nthreads - 1) ? static_cast<int64_t>(filesize) : b + step;
+                threads.emplace_back([this, b, &ends, &parts, &firsts, &stops, t] { scan_range(b, ends[t], parts[t], firsts[t], stops[t]); });
+            }
+            for (auto& t : threads)
+                t.join();
+            // each range must pick the chain up exactly where the range before left it, or a resync landed on
+            // bytes inside a chunk that only looked like a header; a range where no chunk starts must be
+            // stepped over by the chain.  If not, scan the whole file in one pass
+            int64_t at = 0;
+            for (unsigned t = 0; t < nthreads; ++t) {
+                if (firsts[t] < 0 ? at < ends[t] : firsts[t] != at) {
+                    if (debug)
+                        cerr << p << "range " << t << " resynced at " << i2h(firsts[t]) << " but the chain reached "
+                            << i2h(at) << ", scanning in one pass" << endl;
+                    parts.assign(1, vector<ScanEntry>());
+                    ends[0] = filesize;
+                    scan_range(0, ends[0], parts[0], firsts[0], stops[0]);
+                    nthreads = 1;
+                    break;
+                }
+                if (firsts[t] >= 0)
+                    at = stops[t];
+            }
+            for (unsigned t = 0; t < nthreads; ++t)
+                if (stops[t] >= 0 && stops[t] < ends[t] && stops[t] != filesize)
+                    cerr << p << "*** lost the chunk chain at " << i2h(stops[t]) << ", index may be incomplete" << endl;
+            index.clear();
+            index_entries = 0;
+            for (auto& part : parts)
+                for (auto& e : part)
+                    index.emplace_back(this, e.datastartindex, e.perchanneldatalengthinsamples, chunkid_data, e.groupid, e.fileoffset);
+            index_source = "scan";
+            if (debug)
+                cerr << p << "scanned " << nthreads << " range(s), " << index.size() << " data chunks indexed" << endl;
+        }
+
+        ////
+        //// raw data chunks read through a private stream by the index, for work beside the main reader
+        ////
+        typedef struct RawChunk {
+            vector<int32_t> b;                   // the chunk from its chunkid on
+            int64_t         size = 0;            // in bytes
+            int64_t         datastartindex = 0;
+            bool holds(const int32_t ch) const
+            {   // whether channel ch's descriptor, and the counts it points to, lie inside the chunk
+                if (ch < 0 || ch >= b[7] || 32 + 8 * (static_cast<int64_t>(ch) + 1) > size)
+                    return false;
+                const int64_t offset = b[8 + 2*ch], length = b[9 + 2*ch];
+                return offset >= 0 && length >= 0 && offset + length <= size;
+            }
+            const int16_t* counts(const int32_t ch) const { return reinterpret_cast<const int16_t*>(b.data()) + b[8 + 2*ch] / 2; }
+            int32_t readings(const int32_t ch) const { return b[9 + 2*ch] / 2; }
+        } RawChunk;
+
+        void read_raw_chunk(ifstream& f, const size_t i, RawChunk& c, const string& p) const
+        {   // index entry i's data chunk through f into c, exiting if the entry does not point to a whole one
+            auto& e = index[i];
+            int64_t w[2];
+            f.clear();
+            f.seekg(e.fileoffset);
+            f.read(reinterpret_cast<char*>(&w[0]), 16);
+            if (! f || w[0] != chunkid_data || w[1] <= 32 || w[1] > static_cast<int64_t>(buffersz)) {
+                cerr << p << "*** index entry " << i << " does not point to a data chunk at " << i2h(e.fileoffset) << endl;
+                exit(1);
+            }
+            c.size = w[1];
+            c.b.resize((w[1] + 3) / 4);
+            f.seekg(e.fileoffset);
+            f.read(reinterpret_cast<char*>(&c.b[0]), w[1]);
+            if (! f) {
+                cerr << p << "*** data chunk at " << i2h(e.fileoffset) << " runs past the end of the file" << endl;
+                exit(1);
+            }
+            memcpy(&c.datastartindex, &c.b[5], sizeof(c.datastartindex));
+        }
+
+        int32_t raw_readings(const RawChunk& c, const size_t i, const vector<int32_t>& chans, const string& p) const
+        {   // the readings of each of chans in c, index entry i's chunk, exiting if one is missing or they differ
+            int32_t n = -1;
+            for (auto ch : chans) {
+                if (! c.holds(ch)) {
+                    cerr << p << "*** channel " << channelinfo[ch].Name << " missing from data chunk at " << i2h(index[i].fileoffset) << endl;
+                    exit(1);
+                }
+                if (n >= 0 && c.readings(ch) != n) {
+                    cerr << p << "*** channel " << channelinfo[ch].Name << " runs at a different rate; use channels at one rate" << endl;
+                    exit(1);
+                }
+                n = c.readings(ch);
+            }
+            return std::max(n, 0);
+        }
+
+        ////
+        //// zone maps: per-chunk, per-channel min and max counts, so queries can skip chunks
+        ////
+        static void minmax_int16(const int16_t* d, const size_t n, int16_t& mn, int16_t& mx)
+        {   // eight lanes at a time with SSE2 or NEON, then the lanes and any tail reduced by the scalar loop
+            int16_t lo = std::numeric_limits<int16_t>::max(), hi = std::numeric_limits<int16_t>::min();
+            size_t i = 0;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+            if (n >= 8) {
+                int16_t l[8], h[8];
+#if defined(__SSE2__)
+                __m128i vl = _mm_set1_epi16(lo), vh = _mm_set1_epi16(hi);
+                for (; i + 8 <= n; i += 8) {
+                    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i));
+                    vl = _mm_min_epi16(vl, x);
+                    vh = _mm_max_epi16(vh, x);
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(l), vl);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(h), vh);
+#else
+                int16x8_t vl = vdupq_n_s16(lo), vh = vdupq_n_s16(hi);
+                for (; i + 8 <= n; i += 8) {
+                    int16x8_t x = vld1q_s16(d + i);
+                    vl = vminq_s16(vl, x);
+                    vh = vmaxq_s16(vh, x);
+                }
+                vst1q_s16(l, vl);
+                vst1q_s16(h, vh);
+#endif
+                for (auto k = 0; k < 8; ++k) {
+                    lo = l[k] < lo ? l[k] : lo;
+                    hi = h[k] > hi ? h[k] : hi;
+                }
+            }
+#endif
+            for (; i < n; ++i) {
+                lo = d[i] < lo ? d[i] : lo;
+                hi = d[i] > hi ? d[i] : hi;
+            }
+            mn = lo;
+            mx = hi;
+        }
+
+        void zonemap_range(const size_t beg, const size_t end)
+        {   // fill zonemap[] for index entries [beg, end) reading chunks through a private stream
+            static const string p = pfx(cnm + "::" + "zonemap_range", 25);
+            ifstream f(filename, ios::in | ios::binary);
+            RawChunk c;
+            for (auto i = beg; i < end; ++i) {
+                auto& e = index[i];
+                ZoneMap* z = &zonemap[i * numberofchannels];
+                for (auto j = 0; j < numberofchannels; ++j)
+                    z[j] = { 1, 0 };  // min > max, never overlaps anything
+                if (e.chunkid != chunkid_data || e.groupid != groupid)
+                    continue;
+                read_raw_chunk(f, i, c, p);
+                for (auto j = 0; j < numberofchannels; ++j)
+                    if (c.holds(j) && c.readings(j) > 0)
+                        minmax_int16(c.counts(j), c.readings(j), z[j].min, z[j].max);
+            }
+        }
+
+        void build_zonemap()
+        {   // read every indexed data chunk once, splitting the index across threads
+            static const string p = pfx(cnm + "::" + "build_zonemap", 25);
+            zonemap.assign(index.size() * numberofchannels, ZoneMap());
+            unsigned nthreads = scan_threads ? scan_threads : std::max(1u, std::thread::hardware_concurrency());
+            nthreads = std::max(1u, std::min<unsigned>(nthreads, index.size()));
+            vector<std::thread> threads;
+            size_t step = (index.size() + nthreads - 1) / nthreads;
+            for (size_t b = 0; b < index.size(); b += step)
+                threads.emplace_back([this, b, step] { zonemap_range(b, std::min(b + step, index.size())); });
+            for (auto& t : threads)
+                t.join();
+            if (debug)
+                cerr << p << "zone maps built for " << index.size() << " chunks using " << threads.size() << " thread(s)" << endl;
+        }
+
+        int32_t channel_number(const string& s) const
+        {   // a channel given by Name, or by its number
+            for (auto& c : channelinfo)
+                if (c.Name == s)
+                    return c._index;
+            char* e;
+            auto i = strtol(s.c_str(), &e, 10);
+            if (s.empty() || *e || i < 0 || i >= numberofchannels) {
+                cerr << "*** Unknown channel " << s << endl;
+                exit(1);
+            }
+            return static_cast<int32_t>(i);
+        }
+
+        vector<int32_t> channel_list(const string& s) const
+        {   // comma-separated channel names or numbers; empty or "all" means every channel
+            vector<int32_t> v;
+            if (s.empty() || s == "all") {
+                for (auto i = 0; i < numberofchannels; ++i)
+                    v.push_back(i);
+                return v;
+            }
+            stringstream ss(s);
+            string c;
+            while (getline(ss, c, ','))
+                v.push_back(channel_number(c));
+            return v;
+        }
+
+        CountRange count_range(const int32_t ch, const string& op, const double v) const
+        {   // the counts of channel ch whose volts satisfy (volts op v), one interval; != is not one, so the
+            // caller writes it as ! ==.  Volts are monotonic in counts for a linear conversion, and a thermocouple
+            // table gives NaN, which satisfies nothing, only past the ends of its range, but check all the same
+            auto cmp = [&op, v](double x) {
+                if      (op == ">")  return x > v;
+                else if (op == ">=") return x >= v;
+                else if (op == "<")  return x < v;
+                else if (op == "<=") return x <= v;
+                else if (op == "==") return x == v;
+                else { cerr << "*** Unknown comparison " << op << " for a range of counts" << endl; exit(1); }
+            };
+            CountRange r = { 1, 0 };
+            for (int32_t c = std::numeric_limits<int16_t>::min(); c <= std::numeric_limits<int16_t>::max(); ++c) {
+                if (cmp(channelinfo[ch].interpret(static_cast<int16_t>(c)))) {
+                    if (r.empty())
+                        r.lo = c;
+                    r.hi = c;
+                }
+            }
+            for (auto c = r.lo; c <= r.hi; ++c)
+                if (! cmp(channelinfo[ch].interpret(static_cast<int16_t>(c)))) {
+                    cerr << "*** " << channelinfo[ch].Name << " " << op << " " << v
+                        << " is not one range of counts, its conversion is not monotonic" << endl;
+                    exit(1);
+                }
+            return r;
+        }
+
+        ////
+        //// row filter
+        ////
+        void compile_filter(const string& expr)
+        {   // recursive descent over: or := and ('||' and)* ; and := unary ('&&' unary)* ;
+            //                         unary := '!' unary | '(' or ')' | channel op number
+            filter.clear();
+            size_t i = 0;
+            auto fail = [&expr, &i](const string& why) {
+                cerr << "*** Cannot parse filter expression at position " << i << ", " << why << ": " << expr << endl;
+                exit(1);
+            };
+            auto skip = [&expr, &i]() { while (i < expr.size() && isspace(expr[i])) ++i; };
+            auto accept = [&expr, &i, &skip](const string& tok) {
+                skip();
+                if (expr.compare(i, tok.size(), tok)) return false;
+                i += tok.size();
+                return true;
+            };
+            auto add = [this](FilterNode n) { filter.push_back(n); return static_cast<int32_t>(filter.size() - 1); };
+            std::function<int32_t()> parse_or, parse_and, parse_unary;
+            parse_unary = [&]() -> int32_t {
+                if (accept("!")) {
+                    auto a = parse_unary();
+                    return add({ FilterNode::op_not, 0, { 1, 0 }, a, 0 });
+                }
+                if (accept("(")) {
+                    auto a = parse_or();
+                    if (! accept(")")) fail("expected )");
+                    return a;
+                }
+                skip();
+                auto b = i;
+                while (i < expr.size() && ! isspace(expr[i]) && ! strchr("<>=!()&|", expr[i])) ++i;
+                if (i == b) fail("expected channel");
+                auto ch = channel_number(expr.substr(b, i - b));
+                string op;
+                for (auto o : { ">=", "<=", "==", "!=", ">", "<" })
+                    if (accept(o)) { op = o; break; }
+                if (op.empty()) fail("expected comparison");
+                skip();
+                char* e;
+                double v = strtod(expr.c_str() + i, &e);
+                if (e == expr.c_str() + i) fail("expected number");
+                i = e - expr.c_str();
+                if (op == "!=") {  // two ranges of counts
+                    auto a = add({ FilterNode::leaf, ch, count_range(ch, "==", v), 0, 0 });
+                    return add({ FilterNode::op_not, 0, { 1, 0 }, a, 0 });
+                }
+                return add({ FilterNode::leaf, ch, count_range(ch, op, v), 0, 0 });
+            };
+            parse_and = [&]() -> int32_t {
+                auto a = parse_unary();
+                while (accept("&&")) {
+                    auto b = parse_unary();
+                    a = add({ FilterNode::op_and, 0, { 1, 0 }, a, b });
+                }
+                return a;
+            };
+            parse_or = [&]() -> int32_t {
+                auto a = parse_and();
+                while (accept("||")) {
+                    auto b = parse_and();
+                    a = add({ FilterNode::op_or, 0, { 1, 0 }, a, b });
+                }
+                return a;
+            };
+            auto root = parse_or();
+            skip();
+            if (i != expr.size()) fail("unexpected text");
+            if (root != static_cast<int32_t>(filter.size()) - 1) {  // root is always last; a bare '( leaf )' is already
+                FilterNode n = filter[root];
+                filter.push_back(n);
+            }
+            if (debug)
+                cerr << pfx(cnm + "::" + "compile_filter", 25) << filter.size() << " nodes compiled from: " << expr << endl;
+        }
+
+        void compile_derive(const string& def)
+        {   // NAME = expr, where expr := term (('+'|'-') term)* ; term := unary (('*'|'/') unary)* ;
+            //                    unary := '-' unary | number | '(' expr ')' | abs(expr) | sqrt(expr) | channel | derived
+            size_t i = 0;
+            auto fail = [&def, &i](const string& why) {
+                cerr << "*** Cannot parse derived channel at position " << i << ", " << why << ": " << def << endl;
+                exit(1);
+            };
+            auto skip = [&def, &i]() { while (i < def.size() && isspace(def[i])) ++i; };
+            auto accept = [&def, &i, &skip](const char c) {
+                skip();
+                if (i >= def.size() || def[i] != c) return false;
+                ++i;
+                return true;
+            };
+            auto name = [&def, &i, &skip]() {
+                skip();
+                auto b = i;
+                while (i < def.size() && (isalnum(def[i]) || def[i] == '_' || def[i] == '.')) ++i;
+                return def.substr(b, i - b);
+            };
+            Derived d;
+            d.name = name();
+            if (d.name.empty() || isdigit(d.name[0])) fail("expected name");
+            for (auto& c : channelinfo)
+                if (c.Name == d.name) fail("name is a channel");
+            for (auto& o : derived)
+                if (o.name == d.name) fail("name already derived");
+            if (! accept('=')) fail("expected =");
+            auto add = [&d](DeriveNode n) { d.prog.push_back(n); return static_cast<int32_t>(d.prog.size() - 1); };
+            std::function<int32_t()> parse_expr, parse_term, parse_unary;
+            parse_unary = [&]() -> int32_t {
+                if (accept('-')) {
+                    auto a = parse_unary();
+                    return add({ DeriveNode::op_neg, 0, 0.0, a, 0 });
+                }
+                if (accept('(')) {
+                    auto a = parse_expr();
+                    if (! accept(')')) fail("expected )");
+                    return a;
+                }
+                skip();
+                if (i < def.size() && (isdigit(def[i]) || def[i] == '.')) {
+                    char* e;
+                    double v = strtod(def.c_str() + i, &e);
+                    i = e - def.c_str();
+                    return add({ DeriveNode::constant, 0, v, 0, 0 });
+                }
+                auto n = name();
+                if (n.empty()) fail("expected channel, number or (");
+                if (n == "abs" || n == "sqrt") {
+                    if (! accept('(')) fail("expected (");
+                    auto a = parse_expr();
+                    if (! accept(')')) fail("expected )");
+                    return add({ n == "abs" ? DeriveNode::fn_abs : DeriveNode::fn_sqrt, 0, 0.0, a, 0 });
+                }
+                for (size_t k = 0; k < derived.size(); ++k)
+                    if (derived[k].name == n)
+                        return add({ DeriveNode::derived, static_cast<int32_t>(k), 0.0, 0, 0 });
+                return add({ DeriveNode::channel, channel_number(n), 0.0, 0, 0 });
+            };
+            parse_term = [&]() -> int32_t {
+                auto a = parse_unary();
+                for (;;) {
+                    if (accept('*'))      { auto b = parse_unary(); a = add({ DeriveNode::op_mul, 0, 0.0, a, b }); }
+                    else if (accept('/')) { auto b = parse_unary(); a = add({ DeriveNode::op_div, 0, 0.0, a, b }); }
+                    else                  return a;
+                }
+            };
+            parse_expr = [&]() -> int32_t {
+                auto a = parse_term();
+                for (;;) {
+                    if (accept('+'))      { auto b = parse_term(); a = add({ DeriveNode::op_add, 0, 0.0, a, b }); }
+                    else if (accept('-')) { auto b = parse_term(); a = add({ DeriveNode::op_sub, 0, 0.0, a, b }); }
+                    else                  return a;
+                }
+            };
+            auto root = parse_expr();
+            skip();
+            if (i != def.size()) fail("unexpected text");
+            if (root != static_cast<int32_t>(d.prog.size()) - 1) {  // as in compile_filter, root is always last
+                DeriveNode n = d.prog[root];
+                d.prog.push_back(n);
+            }
+            if (debug)
+                cerr << pfx(cnm + "::" + "compile_derive", 25) << d.prog.size() << " nodes compiled from: " << def << endl;
+            derived.push_back(std::move(d));
+        }
+
+        void derive_rows(const int32_t n)
+        {   // evaluate each derived channel over the n rows of channeldata[], one node at a time over whole columns
+            static const string p = pfx(cnm + "::" + "derive_rows", 25);
+            if (n == 0) {  // nothing to index; each derived column is left empty
+                for (auto& d : derived) d.data.clear();
+                return;
+            }
+            vector<vector<double>> m;
+            for (auto& d : derived) {
+                m.resize(d.prog.size());
+                for (size_t k = 0; k < d.prog.size(); ++k) {
+                    auto& f = d.prog[k];
+                    m[k].resize(n);
+                    double* o = &m[k][0];
+                    const double* x = f.op >= DeriveNode::op_add ? &m[f.a][0] : nullptr;
+                    const double* y = f.op >= DeriveNode::op_add && f.op <= DeriveNode::op_div ? &m[f.b][0] : nullptr;
+                    switch (f.op) {
+                        case DeriveNode::channel: {
+                            auto& ci = channelinfo[f.ch];
+                            auto& cd = channeldata[f.ch].data;
+                            if (static_cast<int32_t>(cd.size()) < n) {
+                                cerr << p << "*** channel " << ci.Name << " has fewer readings than the chunk's rows; channels run at different rates" << endl;
+                                exit(1);
+                            }
+                            const int16_t* c = &cd[0];
+                            if (ci.lut) {
+                                const double* t = &(*ci.lut)[32768];
+                                for (auto i = 0; i < n; ++i) o[i] = t[c[i]];
+                            } else {
+                                const double sc = ci.out_scale, of = ci.out_offset;
+                                for (auto i = 0; i < n; ++i) o[i] = c[i] * sc + of;
+                            }
+                            break;
+                        }
+                        case DeriveNode::derived:
+                            std::copy(derived[f.ch].data.begin(), derived[f.ch].data.begin() + n, o);
+                            break;
+                        case DeriveNode::constant: std::fill(o, o + n, f.v); break;
+                        case DeriveNode::op_add:   for (auto i = 0; i < n; ++i) o[i] = x[i] + y[i]; break;
+                        case DeriveNode::op_sub:   for (auto i = 0; i < n; ++i) o[i] = x[i] - y[i]; break;
+                        case DeriveNode::op_mul:   for (auto i = 0; i < n; ++i) o[i] = x[i] * y[i]; break;
+                        case DeriveNode::op_div:   for (auto i = 0; i < n; ++i) o[i] = x[i] / y[i]; break;
+                        case DeriveNode::op_neg:   for (auto i = 0; i < n; ++i) o[i] = -x[i]; break;
+                        case DeriveNode::fn_abs:   for (auto i = 0; i < n; ++i) o[i] = std::abs(x[i]); break;
+                        case DeriveNode::fn_sqrt:  for (auto i = 0; i < n; ++i) o[i] = std::sqrt(x[i]); break;
+                    }
+                }
+                d.data.swap(m.back());
+            }
+        }
+
+        void filter_rows(const int32_t n)
+        {   // evaluate the filter over the n rows of channeldata[] into row_mask[], one node at a time over whole columns
+            static const string p = pfx(cnm + "::" + "filter_rows", 25);
+            if (n == 0) {
+                row_mask.clear();
+                return;
+            }
+            vector<vector<uint8_t>> m(filter.size());
+            for (size_t k = 0; k < filter.size(); ++k) {  // operands always precede their operators
+                auto& f = filter[k];
+                m[k].resize(n);
+                uint8_t* o = &m[k][0];
+                switch (f.op) {
+                    case FilterNode::leaf: {
+                        auto& cd = channeldata[f.ch].data;
+                        if (static_cast<int32_t>(cd.size()) < n) {
+                            cerr << p << "*** channel " << channelinfo[f.ch].Name << " has fewer readings than the chunk's rows; channels run at different rates" << endl;
+                            exit(1);
+                        }
+                        const int16_t* d = &cd[0];
+                        const int32_t lo = f.r.lo, hi = f.r.hi;
+                        for (auto i = 0; i < n; ++i)
+                            o[i] = (d[i] >= lo) & (d[i] <= hi);
+                        break;
+                    }
+                    case FilterNode::op_and:
+                        for (auto i = 0; i < n; ++i) o[i] = m[f.a][i] & m[f.b][i];
+                        break;
+                    case FilterNode::op_or:
+                        for (auto i = 0; i < n; ++i) o[i] = m[f.a][i] | m[f.b][i];
+                        break;
+                    case FilterNode::op_not:
+                        for (auto i = 0; i < n; ++i) o[i] = ! m[f.a][i];
+                        break;
+                }
+            }
+            row_mask.swap(m.back());
+        }
+
+        int filter_zone(const size_t entry) const
+        {   // whether no, some or all rows of an indexed chunk can pass the filter, judged from its zone map
+            if (zonemap.size() != index.size() * numberofchannels)
+                return zone_some;
+            vector<int> z(filter.size());
+            for (size_t k = 0; k < filter.size(); ++k) {
+                auto& f = filter[k];
+                switch (f.op) {
+                    case FilterNode::leaf: {
+                        auto& zm = zonemap[entry * numberofchannels + f.ch];
+                        if (zm.min > zm.max || ! f.r.overlaps(zm))  z[k] = zone_none;
+                        else if (f.r.lo <= zm.min && zm.max <= f.r.hi) z[k] = zone_all;
+                        else                                          z[k] = zone_some;
+                        break;
+                    }
+                    case FilterNode::op_and:
+                        z[k] = (z[f.a] == zone_none || z[f.b] == zone_none) ? zone_none
+                             : (z[f.a] == zone_all && z[f.b] == zone_all) ? zone_all : zone_some;
+                        break;
+                    case FilterNode::op_or:
+                        z[k] = (z[f.a] == zone_all || z[f.b] == zone_all) ? zone_all
+                             : (z[f.a] == zone_none && z[f.b] == zone_none) ? zone_none : zone_some;
+                        break;
+                    case FilterNode::op_not:
+                        z[k] = (z[f.a] == zone_all) ? zone_none : (z[f.a] == zone_none) ? zone_all : zone_some;
+                        break;
+                }
+            }
+            return z.back();
+        }
+
+        void read_indexed()
+        {   // read data chunks through the index rather than sequentially, skipping those the filter's zone map rules out
+            static const string p = pfx(cnm + "::" + "read_indexed", 25);
+            int64_t read = 0;
+            for (size_t i = 0; i < index.size(); ++i) {
+                if (index[i].chunkid != chunkid_data || index[i].groupid != groupid)
+                    continue;
+                if (filter.size() && filter_zone(i) == zone_none) {
+                    data_lines += index[i].perchanneldatalengthinsamples;  // keep downsampling in step
+                    continue;
+                }
+                read_chunk_at(index[i].fileoffset);
+                ++read;
+            }
+            if (debug)
+                cerr << p << "read " << read << " of " << index.size() << " chunks" << endl;
+        }
+
+        void query_periods(const int32_t ch, const CountRange& r, const string sep = DEFAULT_SEP)
+        {   // print the sample ranges where channel ch is within r, reading only chunks whose zone map overlaps r
+            static const string p = pfx(cnm + "::" + "query_periods", 25);
+            if (zonemap.size() != index.size() * numberofchannels) {
+                build_zonemap();
+                if (use_sidecar)
+                    write_sidecar();
+            }
+            auto& ci = channelinfo[ch];
+            cout << "StartSample" << sep << "EndSample" << sep << "StartTime(s)" << sep << "EndTime(s)" << sep << "Peak(" << ci.out_unit << ")" << endl;
+            int64_t start = -1, end = -1, read = 0;
+            int16_t peak = 0;
+            // peak is the extreme sample furthest into the range: the minimum for a range open only at the bottom
+            bool want_max = ! (r.lo == std::numeric_limits<int16_t>::min() && r.hi != std::numeric_limits<int16_t>::max());
+            auto close_period = [&]() {
+                if (start < 0)
+                    return;
+                cout << start << sep << end << sep << setprecision(15) << start * ci.TimeIncrement
+                    << sep << end * ci.TimeIncrement << sep << ci.interpret(peak) << endl;
+                start = -1;
+            };
+            auto save_table = table;
+            table = false;
+            for (size_t i = 0; i < index.size(); ++i) {
+                if (index[i].groupid != groupid)
+                    continue;  // another group's chunks do not break a period
+                if (index[i].chunkid != chunkid_data || ! r.overlaps(zonemap[i * numberofchannels + ch])) {
+                    close_period();
+                    continue;
+                }
+                read_chunk_at(index[i].fileoffset);
+                ++read;
+                if (start >= 0 && last_datastartindex != end)
+                    close_period();  // discontinuity between chunks
+                auto& d = channeldata[ch].data;
+                for (size_t j = 0; j < d.size(); ++j) {
+                    if (r.test(d[j])) {
+                        if (start < 0) {
+                            start = last_datastartindex + j;
+                            peak = d[j];
+                        }
+                        end = last_datastartindex + j + 1;
+                        if (want_max ? d[j] > peak : d[j] < peak)
+                            peak = d[j];
+                    } else {
+                        close_period();
+                    }
+                }
+            }
+            close_period();
+            table = save_table;
+            if (debug)
+                cerr << p << "read " << read << " of " << index.size() << " chunks" << endl;
+        }
+
+        typedef struct CoMoments {
+            int64_t        n = 0;
+            vector<double> mean;  // per channel
+            vector<double> c;     // k x k sums of products of deviations from the means
+            void merge(const CoMoments& o)
+            {   // pairwise update of Chan, Golub and LeVeque, so partial results combine in any grouping
+                if (! o.n)
+                    return;
+                if (! n) {
+                    *this = o;
+                    return;
+                }
+                const size_t k = mean.size();
+                const double nn = static_cast<double>(n) + o.n, f = static_cast<double>(n) * o.n / nn;
+                vector<double> d(k);
+                for (size_t i = 0; i < k; ++i)
+                    d[i] = o.mean[i] - mean[i];
+                for (size_t i = 0; i < k; ++i)
+                    for (size_t j = 0; j < k; ++j)
+                        c[i * k + j] += o.c[i * k + j] + d[i] * d[j] * f;
+                for (size_t i = 0; i < k; ++i)
+                    mean[i] += d[i] * o.n / nn;
+                n += o.n;
+            }
+        } CoMoments;
+
+        static CoMoments comoments(const vector<double>& x, const size_t stride, const size_t b, const size_t m, const size_t k)
+        {   // co-moments of rows [b, b + m) of k columns held one after another, stride apart, in x
+            CoMoments r;
+            if (! m)
+                return r;
+            r.n = m;
+            r.mean.assign(k, 0.0);
+            r.c.assign(k * k, 0.0);
+            vector<double> dev(k * m);  // deviations, column by column, so each product below is a plain dot product
+            for (size_t i = 0; i < k; ++i) {
+                const double* col = &x[i * stride + b];
+                const double c0 = col[0];  // shifting by the first reading keeps a constant column's deviations exactly zero
+                double s = 0.0;
+                for (size_t t = 0; t < m; ++t)
+                    s += col[t] - c0;
+                r.mean[i] = c0 + s / m;
+                double* o = &dev[i * m];
+                const double mu = r.mean[i];
+                for (size_t t = 0; t < m; ++t)
+                    o[t] = col[t] - mu;
+            }
+            for (size_t i = 0; i < k; ++i)
+                for (size_t j = i; j < k; ++j) {
+                    const double* p = &dev[i * m];
+                    const double* q = &dev[j * m];
+                    double s = 0.0;
+                    for (size_t t = 0; t < m; ++t)
+                        s += p[t] * q[t];
+                    r.c[i * k + j] = r.c[j * k + i] = s;
+                }
+            return r;
+        }
+
+        void corr_range(const size_t beg, const size_t end, const vector<int32_t>& chans, const int64_t block,
+                        const int64_t first, map<int64_t, CoMoments>& out) const
+        {   // co-moments of chans for the data chunks of index entries [beg, end), per block of readings, through a private stream
+            static const string p = pfx(cnm + "::" + "corr_range", 25);
+            ifstream f(filename, ios::in | ios::binary);
+            RawChunk c;
+            vector<double> x;
+            const size_t k = chans.size();
+            for (auto i = beg; i < end; ++i) {
+                auto& e = index[i];
+                if (e.chunkid != chunkid_data || e.groupid != groupid)
+                    continue;
+                read_raw_chunk(f, i, c, p);
+                const int64_t dsi = c.datastartindex;
+                const int32_t n = raw_readings(c, i, chans, p);
+                x.resize(k * n);
+                for (size_t j = 0; j < k; ++j) {  // convert each column once
+                    auto& ci = channelinfo[chans[j]];
+                    const int16_t* d = c.counts(chans[j]);
+                    double* o = &x[j * n];
+                    if (ci.lut) {
+                        const double* t = &(*ci.lut)[32768];
+                        for (auto r = 0; r < n; ++r) o[r] = t[d[r]];
+                    } else {
+                        const double sc = ci.out_scale, of = ci.out_offset;
+                        for (auto r = 0; r < n; ++r) o[r] = d[r] * sc + of;
+                    }
+                }
+                for (int64_t s = 0; s < n; ) {  // split the chunk's rows at block boundaries
+                    int64_t blk = block ? (dsi + s - first) / block : 0;
+                    int64_t e2 = block ? std::min<int64_t>(n, first + (blk + 1) * block - dsi) : n;
+                    out[blk].merge(comoments(x, n, s, e2 - s, k));
+                    s = e2;
+                }
+            }
+        }
+
+        void correlation(const vector<int32_t>& chans, const int64_t block, const string sep = DEFAULT_SEP)
+        {   // correlation and covariance of chans over the whole recording, or for each block readings; the index is
+            // split across threads whose partial co-moments are merged at the end
+            static const string p = pfx(cnm + "::" + "correlation", 25);
+            int64_t first, end;
+            indexed_samples(first, end);
+            unsigned nthreads = scan_threads ? scan_threads : std::max(1u, std::thread::hardware_concurrency());
+            nthreads = std::max(1u, std::min<unsigned>(nthreads, index.size()));
+            vector<map<int64_t, CoMoments>> parts(nthreads);
+            vector<std::thread> threads;
+            size_t step = (index.size() + nthreads - 1) / nthreads;
+            for (unsigned t = 0; t < nthreads && t * step < index.size(); ++t)
+                threads.emplace_back([this, t, step, &chans, block, first, &parts] {
+                    corr_range(t * step, std::min(t * step + step, index.size()), chans, block, first, parts[t]);
+                });
+            for (auto& t : threads)
+                t.join();
+            map<int64_t, CoMoments> all;
+            for (auto& part : parts)
+                for (auto& b : part)
+                    all[b.first].merge(b.second);
+            if (debug)
+                cerr << p << all.size() << " block(s) from " << index.size() << " chunks using " << threads.size() << " thread(s)" << endl;
+            const size_t k = chans.size();
+            auto corr = [k](const CoMoments& m, size_t i, size_t j) {  // undefined for a channel that does not vary
+                double d = m.c[i * k + i] * m.c[j * k + j];
+                return d > 0.0 ? m.c[i * k + j] / sqrt(d) : std::numeric_limits<double>::quiet_NaN();
+            };
+            auto cov = [k](const CoMoments& m, size_t i, size_t j) {
+                return m.n > 1 ? m.c[i * k + j] / (m.n - 1) : std::numeric_limits<double>::quiet_NaN();
+            };
+            stringstream ss;
+            ss << setprecision(15);
+            if (! block) {
+                auto& m = all[0];
+                if (! m.n) {
+                    cerr << p << "*** no readings, no correlation" << endl;
+                    return;
+                }
+                for (auto pass = 0; pass < 2; ++pass) {
+                    ss << (pass ? "Covariance" : "Correlation");
+                    for (auto c : chans)
+                        ss << sep << channelinfo[c].Name;
+                    ss << endl;
+                    for (size_t i = 0; i < k; ++i) {
+                        ss << channelinfo[chans[i]].Name;
+                        for (size_t j = 0; j < k; ++j)
+                            ss << sep << (pass ? cov(m, i, j) : corr(m, i, j));
+                        ss << endl;
+                    }
+                }
+                ss << "Readings" << sep << m.n << endl;
+            } else {
+                ss << "BlockStart" << sep << "Time(s)" << sep << "Readings" << sep << "Channel1" << sep << "Channel2"
+                    << sep << "Covariance" << sep << "Correlation" << endl;
+                for (auto& b : all) {
+                    auto start = first + b.first * block;
+                    for (size_t i = 0; i < k; ++i)
+                        for (size_t j = i + 1; j < k; ++j)
+                            ss << start << sep << start * channelinfo[chans[0]].TimeIncrement << sep << b.second.n
+                                << sep << channelinfo[chans[i]].Name << sep << channelinfo[chans[j]].Name
+                                << sep << cov(b.second, i, j) << sep << corr(b.second, i, j) << endl;
+                }
+            }
+            cout << ss.str();
+        }
+
+        ////
+        //// .hpfidx sidecar holding the header, channelinfo, eventdefinition and index, so read_info()
+        //// can skip XML parsing and index scanning.  Keyed on file size, mtime and a hash of the
+        //// leading sidecar_hash_bytes of the file
+        ////
+        static const int32_t sidecar_version    = 2;
+        static const size_t  sidecar_hash_bytes = 4096;
+
+        const string& file_name() const
+        {
+            return filename;
+        }
+
+        string sidecar_name() const
+        {
+            auto n = filename.size();
+            if (n > 4 && ToLower(filename.substr(n - 4)) == ".hpf")
+                return filename.substr(0, n - 4) + ".hpfidx";
+            return filename + ".hpfidx";
+        }
+
+        bool sidecar_key(int64_t& size, int64_t& mtime, uint64_t& hash) const
+        {
+            struct stat st;
+            if (stat(filename.c_str(), &st))
+                return false;
+            size = st.st_size;
+            mtime = st.st_mtime;
+            ifstream f(filename, ios::in | ios::binary);
+            char b[sidecar_hash_bytes];
+            f.read(b, sizeof(b));
+            hash = 0xcbf29ce484222325ULL;  // FNV-1a
+            for (auto i = 0; i < f.gcount(); ++i) {
+                hash ^= static_cast<unsigned char>(b[i]);
+                hash *= 0x100000001b3ULL;
+            }
+            return true;
+        }
+
+        bool write_sidecar() const
+        {
+            static const string p = pfx(cnm + "::" + "write_sidecar", 25);
+            int64_t size, mtime;
+            uint64_t hash;
+            if (groups.size() > 1) {  // the sidecar holds a single group's channelinfo
+                if (debug)
+                    cerr << p << "file has " << groups.size() << " channel groups, no sidecar written" << endl;
+                return false;
+            }
+            if (! sidecar_key(size, mtime, hash))
+                return false;
+            BinWriter w;
+            w.buf.append("HPFIDX\0\0", 8);
+            w.put(sidecar_version);
+            w.put(size); w.put(mtime); w.put(hash);
+            w.put(creatorid); w.put(fileversion); w.put(indexchunkoffset);
+            w.put_string(recdate);
+            w.put(groupid); w.put(numberofchannels);
+            for (auto& c : channelinfo) {
+                w.put_string(c.Name); w.put_string(c.Unit); w.put_string(c.ChannelType);
+                w.put(c.AssignedTimeChannelIndex); w.put_string(c.DataType); w.put(c.DataIndex);
+                w.put_string(c.StartTime.s_time); w.put(c.TimeIncrement);
+                w.put(c.RangeMin); w.put(c.RangeMax); w.put(c.DataScale); w.put(c.DataOffset);
+                w.put(c.SensorScale); w.put(c.SensorOffset); w.put(c.PerChannelSampleRate);
+                w.put(c.PhysicalChannelNumber); w.put(c.UsesSensorValues); w.put_string(c.ThermocoupleType);
+                w.put_string(c.TemperatureUnit); w.put(c.UseThermocoupleValues);
+            }
+            w.put(static_cast<int32_t>(eventdefinition.size()));
+            for (auto& e : eventdefinition) {
+                w.put_string(e.Name); w.put_string(e.Description); w.put(e.Class); w.put(e.ID); w.put_string(e.Type);
+                w.put(e.UsesIData1); w.put(e.UsesIData2);
+                w.put(e.UsesDData1); w.put(e.UsesDData2); w.put(e.UsesDData3); w.put(e.UsesDData4);
+                w.put_string(e.DescriptionIData1); w.put_string(e.DescriptionIData2);
+                w.put_string(e.DescriptionDData1); w.put_string(e.DescriptionDData2);
+                w.put_string(e.DescriptionDData3); w.put_string(e.DescriptionDData4);
+                w.put_string(e.Parameter1); w.put_string(e.Parameter2); w.put_string(e.Tolerance);
+                w.put(e.UsesParameter1); w.put(e.UsesParameter2); w.put(e.UsesTolerance);
+                w.put_string(e.DescriptionParameter1); w.put_string(e.DescriptionParameter2); w.put_string(e.DescriptionTolerance);
+            }
+            w.put_string(index_source);
+            w.put(static_cast<int64_t>(index.size()));
+            for (auto& c : index) {
+                w.put(c.datastartindex); w.put(c.perchanneldatalengthinsamples);
+                w.put(c.chunkid); w.put(c.groupid); w.put(c.fileoffset);
+            }
+            w.put(static_cast<int64_t>(zonemap.size()));
+            for (auto& z : zonemap) {
+                w.put(z.min); w.put(z.max);
+            }
+            string tmp = sidecar_name() + ".tmp";  // write then rename, so readers never see a partial sidecar
+            ofstream o(tmp, ios::out | ios::binary | ios::trunc);
+            o.write(w.buf.data(), w.buf.size());
+            o.close();
+            if (! o || rename(tmp.c_str(), sidecar_name().c_str())) {
+                if (debug)
+                    cerr << p << "could not write " << sidecar_name() << endl;
+                unlink(tmp.c_str());
+                return false;
+            }
+            if (debug)
+                cerr << p << "wrote " << w.buf.size() << " bytes to " << sidecar_name() << endl;
+            return true;
+        }
+
+        bool load_sidecar()
+        {
+            static const string p = pfx(cnm + "::" + "load_sidecar", 25);
+            int64_t size, mtime;
+            uint64_t hash;
+            if (! sidecar_key(size, mtime, hash))
+                return false;
+            int fd = open(sidecar_name().c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) || st.st_size < 8) { close(fd); return false; }
+            void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (m == MAP_FAILED)
+                return false;
+            BinReader r(static_cast<const char*>(m), st.st_size);
+            bool ok = false;
+            if (! memcmp(r.ptr, "HPFIDX\0\0", 8)) {
+                r.ptr += 8;
+                auto version = r.get<int32_t>();
+                if (version != sidecar_version) {
+                    if (debug) cerr << p << sidecar_name() << " is version " << version << ", need " << sidecar_version << endl;
+                } else if (r.get<int64_t>() != size || r.get<int64_t>() != mtime || r.get<uint64_t>() != hash) {
+                    if (debug) cerr << p << sidecar_name() << " is stale" << endl;
+                } else {
+                    ok = read_sidecar(r);
+                }
+            }
+            munmap(m, st.st_size);
+            if (debug)
+                cerr << p << (ok ? "loaded " : "did not load ") << sidecar_name() << endl;
+            return ok;
+        }
+
+    private:
+
+        bool read_sidecar(BinReader& r)
+        {   // the body of the sidecar following the key, read into locals so members change only if all of it is good;
+            // counts are checked against the bytes left before anything is allocated for them
+            auto cid = r.get<int32_t>();
+            auto fver = r.get<int64_t>();
+            auto ico = r.get<int64_t>();
+            auto rdate = r.get_string();
+            auto gid = r.get<int32_t>();
+            auto nch = r.get<int32_t>();
+            if (! r.ok || nch <= 0 || static_cast<size_t>(nch) > r.left())
+                return false;
+            vector<ChannelInfo> ci(nch);
+            for (auto i = 0; i < nch; ++i) {
+                auto& c = ci[i];
+                c._index = i;
+                c.Name = r.get_string(); c.Unit = r.get_string(); c.ChannelType = r.get_string();
+                c.AssignedTimeChannelIndex = r.get<int32_t>(); c.DataType = r.get_string(); c.DataIndex = r.get<int32_t>();
+                c.StartTime.interpret(r.get_string()); c.TimeIncrement = r.get<double>();
+                c.RangeMin = r.get<int16_t>(); c.RangeMax = r.get<int16_t>();
+                c.DataScale = r.get<double>(); c.DataOffset = r.get<double>();
+                c.SensorScale = r.get<double>(); c.SensorOffset = r.get<double>(); c.PerChannelSampleRate = r.get<double>();
+                c.PhysicalChannelNumber = r.get<int32_t>(); c.UsesSensorValues = r.get<bool>(); c.ThermocoupleType = r.get_string();
+                c.TemperatureUnit = r.get_string(); c.UseThermocoupleValues = r.get<bool>();
+            }
+            auto ndef = r.get<int32_t>();
+            if (! r.ok || ndef < 0 || static_cast<size_t>(ndef) > r.left())
+                return false;
+            vector<EventDefinition> ed(ndef);
+            for (auto i = 0; i < ndef; ++i) {
+                auto& e = ed[i];
+                e.eventdef_index = i;
+                e.Name = r.get_string(); e.Description = r.get_string(); e.Class = r.get<int32_t>(); e.ID = r.get<int32_t>(); e.Type = r.get_string();
+                e.UsesIData1 = r.get<bool>(); e.UsesIData2 = r.get<bool>();
+                e.UsesDData1 = r.get<bool>(); e.UsesDData2 = r.get<bool>(); e.UsesDData3 = r.get<bool>(); e.UsesDData4 = r.get<bool>();
+                e.DescriptionIData1 = r.get_string(); e.DescriptionIData2 = r.get_string();
+                e.DescriptionDData1 = r.get_string(); e.DescriptionDData2 = r.get_string();
+                e.DescriptionDData3 = r.get_string(); e.DescriptionDData4 = r.get_string();
+                e.Parameter1 = r.get_string(); e.Parameter2 = r.get_string(); e.Tolerance = r.get_string();
+                e.UsesParameter1 = r.get<bool>(); e.UsesParameter2 = r.get<bool>(); e.UsesTolerance = r.get<bool>();
+                e.DescriptionParameter1 = r.get_string(); e.DescriptionParameter2 = r.get_string(); e.DescriptionTolerance = r.get_string();
+            }
+            auto isrc = r.get_string();
+            auto n = r.get<int64_t>();
+            static const size_t entry_bytes = 5 * sizeof(int64_t);
+            if (! r.ok || n < 0 || static_cast<uint64_t>(n) > r.left() / entry_bytes)
+                return false;
+            vector<int64_t> ix(5 * n);
+            for (auto& x : ix)
+                x = r.get<int64_t>();
+            auto nz = r.get<int64_t>();
+            if (! r.ok || (nz != 0 && nz != n * nch) || static_cast<uint64_t>(nz) > r.left() / (2 * sizeof(int16_t)))
+                return false;
+            vector<ZoneMap> zm(nz);
+            for (auto& z : zm) {
+                z.min = r.get<int16_t>();
+                z.max = r.get<int16_t>();
+            }
+            if (! r.ok)
+                return false;
+            creatorid = cid;
+            creatorid_s = interpret_creatorid(creatorid);
+            fileversion = fver;
+            indexchunkoffset = ico;
+            recdate = rdate;
+            rectime.interpret(recdate);
+            groupid = first_groupid = gid;
+            numberofchannels = nch;
+            channelinfo.swap(ci);
+            channeldata.assign(nch, ChannelData());
+            for (auto i = 0; i < nch; ++i)
+                channeldata[i]._index = i;
+            set_conversions();
+            definitioncount = ndef;
+            eventdefinition.swap(ed);
+            index_source = isrc;
+            index.clear();
+            index_entries = 0;
+            index.reserve(n);
+            for (int64_t i = 0; i < n; ++i)
+                index.emplace_back(this, ix[5 * i], ix[5 * i + 1], ix[5 * i + 2], ix[5 * i + 3], ix[5 * i + 4]);
+            zonemap.swap(zm);
+            return true;
+        }
+
+    public:
+
+        string index_text() const
+        {
+            stringstream ss;
+            for (auto& c : index)
+                ss << c.out() << endl;
+            return ss.str();
+        }
+
+        int64_t indexed_samples(int64_t& first, int64_t& end) const
+        {   // sum of per-channel samples in index entries for our data group; first and end bound the datastartindex range
+            int64_t n = 0;
+            first = end = 0;
+            bool seen = false;
+            for (auto& c : index) {
+                if (c.chunkid != chunkid_data || c.groupid != groupid)
+                    continue;
+                n += c.perchanneldatalengthinsamples;
+                if (! seen || c.datastartindex < first)
+                    first = c.datastartindex;
+                if (! seen || c.datastartindex + c.perchanneldatalengthinsamples > end)
+                    end = c.datastartindex + c.perchanneldatalengthinsamples;
+                seen = true;
+            }
+            return n;
+        }
+
+        string info_text(const string sep = DEFAULT_SEP) const
+        {
+            stringstream ss;
+            int64_t first, end;
+            auto n = indexed_samples(first, end);
+            ss << "File :" << sep << filename << endl
+                << "FileSize :" << sep << filesize << endl
+                << "CreatorID :" << sep << creatorid_s << endl
+                << "FileVersion :" << sep << fileversion << endl
+                << "RecordingDate :" << sep << recdate << endl
+                << "GroupID :" << sep << groupid << endl
+                << "Groups :" << sep << group_ids() << endl
+                << "Channels Recorded :" << sep << numberofchannels << endl
+                << "PerChannelSamplingFreq :" << sep << setprecision(15) << channelinfo[0].PerChannelSampleRate << endl
+                << "IndexEntries :" << sep << index.size() << endl
+                << "IndexSource :" << sep << index_source << endl;
+            if (index.size()) {
+                ss << "TotalSamples :" << sep << n << endl
+                    << "FirstSample :" << sep << first << endl
+                    << "EndSample :" << sep << end << endl
+                    << "Duration(s) :" << sep << setprecision(15) << n * channelinfo[0].TimeIncrement << endl;
+            } else {
+                ss << "TotalSamples :" << sep << "unknown (no index)" << endl;
+            }
+            ss << "EventDefinitions :" << sep << eventdefinition.size() << endl;
+            ss << "ZoneMaps :" << sep << (zonemap.size() ? "yes" : "no") << endl;
+            ss << "" << sep << "" << endl;
+            ss << "ChannelName" << sep << "ChannelNumber" << sep << "Units" << sep << "DataType" << sep
+                << "PerChannelSampleRate" << sep << "StartTime" << endl;
+            for (auto& c : channelinfo) {
+                ss << c.Name
+                    << sep << c.DataIndex
+                    << sep << c.Unit
+                    << sep << c.DataType
+                    << sep << c.PerChannelSampleRate
+                    << sep << c.StartTime.s_time
+                    << endl;
+            }
+            return ss.str();
+        }
+
+        string info_json() const
+        {
+            stringstream ss;
+            int64_t first, end;
+            auto n = indexed_samples(first, end);
+            ss << "{" << "\"file\":" << json_string(filename)
+                << ",\"filesize\":" << filesize
+                << ",\"creatorid\":" << json_string(creatorid_s)
+                << ",\"fileversion\":" << fileversion
+                << ",\"recordingdate\":" << json_string(recdate)
+                << ",\"groupid\":" << groupid
+                << ",\"groups\":[" << group_ids() << "]"
+                << ",\"numberofchannels\":" << numberofchannels
+                << ",\"samplerate\":" << setprecision(15) << channelinfo[0].PerChannelSampleRate
+                << ",\"indexentries\":" << index.size()
+                << ",\"indexsource\":" << json_string(index_source);
+            if (index.size()) {
+                ss << ",\"totalsamples\":" << n
+                    << ",\"firstsample\":" << first
+                    << ",\"endsample\":" << end
+                    << ",\"duration\":" << n * channelinfo[0].TimeIncrement;
+            } else {
+                ss << ",\"totalsamples\":null,\"duration\":null";
+            }
+            ss << ",\"eventdefinitions\":" << eventdefinition.size()
+                << ",\"zonemaps\":" << (zonemap.size() ? "true" : "false")
+                << ",\"channels\":[";
+            for (auto& c : channelinfo) {
+                if (c._index)
+                    ss << ",";
+                ss << "{\"name\":" << json_string(c.Name)
+                    << ",\"index\":" << c.DataIndex
+                    << ",\"unit\":" << json_string(c.Unit)
+                    << ",\"datatype\":" << json_string(c.DataType)
+                    << ",\"samplerate\":" << c.PerChannelSampleRate
+                    << ",\"starttime\":" << json_string(c.StartTime.s_time)
+                    << "}";
+            }
+            ss << "]}" << endl;
+            return ss.str();
+        }
+
+        string table_header_csv(bool minimal = false, const string sep = DEFAULT_SEP) const
+        {
+            stringstream ss;
+            if (! minimal) {
+                ss << "RecordingDate :" << sep << recdate << endl
+                    << "FromSample(TimeOfDay):" << sep << "xx:xx:xx.xxx" << endl
+                    << "ToSample(TimeOfDay):" << sep << "yy:yy:yy.yyy" << endl
+                    << "" << sep << "" << endl
+                    << "Channels Recorded " << sep << "" << numberofchannels << endl
+                    << "PerChannelSamplingFreq :" << sep << "" << setprecision(15) << channelinfo[0].PerChannelSampleRate << endl;
+                if (do_downsample) {
+                    ss << "DownsampleCount :" << sep << "" << downsample_count << endl;
+                }
+                ss << "" << sep << "" << endl;
+                // channelinfo
+                ss << "ChannelName" << sep << "ChannelNumber" << sep << "Units" << sep << "DataType" << sep 
+                    << "RangeMin" << sep << "RangeMax" << sep << "DataScale" << sep << "DataOffset" << sep
+                    << "SensorScale" << sep << "SensorOffset" << endl;
+                for (auto c : channelinfo) {
+                    ss << c.Name
+                        << sep << c.DataIndex
+                        << sep << c.Unit
+                        << sep << c.DataType
+                        << sep << c.RangeMin
+                        << sep << c.RangeMax
+                        << sep << c.DataScale
+                        << sep << c.DataOffset
+                        << sep << c.SensorScale
+                        << sep << c.SensorOffset
+                        << endl;
+                }
+                ss << "" << sep << "" << endl;
+                if (include_data_line)
+                    ss << "data_line" << sep;
+            }
+            if (timecol.mode != TimeColumn::none)
+                ss << "Time" << sep;
+            for (auto i = 0; i < numberofchannels; ++i) {
+                ss << channelinfo[i].Name;
+                if (i < numberofchannels - 1)
+                    ss << sep;
+            }
+            for (auto& d : derived)
+                ss << sep << d.name;
+            ss << endl;
+            return ss.str();
+        }
+        string table_from_data_csv(const vector<ChannelDescriptor>& cd,
+                                   const string sep = DEFAULT_SEP)
+            // output all data in channeldata[] using channeldescriptor[]
+        {
+            if (! table_header_done) { // this is the first data, so drop the header first
+                if (timecol.mode != TimeColumn::none)
+                    timecol.setup(timecol.mode, channelinfo[0].StartTime, channelinfo[0].TimeIncrement);
+                *table_out << table_header_csv(true);
+                table_header_done = true;
+            }
+            stringstream ss;
+            // fetch the number of items from the first channel descriptor
+            auto n = cd[0]._num_atoms;
+            for (auto& c : cd) {
+                if (c._num_atoms != n) {
+                    cerr << "*** channel " << channelinfo[c._index].Name << " has " << c._num_atoms << " readings in this chunk but "
+                        << channelinfo[0].Name << " has " << n << "; channels run at different rates, use --align" << endl;
+                    exit(1);
+                }
+            }
+
+            for (auto i = 0; i < n; ++i) {
+                ++data_lines;  // the line of data in the table (all lines)
+                if (do_downsample && (data_lines - 1) % downsample_count) {
+                    // if we are downsampling, only output lines where (data_lines - 1) mod downsample_count == 0
+                    // so skip this line
+                    continue;
+                }
+                if (filter.size() && ! row_mask[i])
+                    continue;
+                table_data_lines++;  // the line of data in the table (all lines)
+                if (include_data_line)
+                    ss << (data_lines - 0) << sep;
+                if (timecol.mode != TimeColumn::none) {
+                    size_t len;
+                    const char* t = timecol.format(last_datastartindex + i, len);
+                    ss.write(t, len);
                     ss << sep;
+                }
+                for (auto j = 0; j < numberofchannels; ++j) {  // across each column/channel
+                    ss << setprecision(15) << channelinfo[j].interpret(channeldata[j].data[i]);
+                    if (j < numberofchannels - 1)
+                        ss << sep;
+                }
+                for (auto& d : derived)
+                    ss << sep << setprecision(15) << d.data[i];
+                ss << endl;
+            }
+            return ss.str();
+        }
+};
+
+std::ostream& operator<<(std::ostream& os, const HPFFile::Time& t)     { return os << t.out(); }
+std::ostream& operator<<(std::ostream& os, const HPFFile::DataType& t) { return os << t.out(); }
+
+bool DataSink::follows(const HPFFile& h, const string& cnm, const int64_t dsi, const int32_t n)
+{
+    gap_at = expected;
+    expected = dsi + n;
+    if (gap_at < 0 || dsi == gap_at)
+        return true;
+    if (h.debug)
+        cerr << cnm << ": " << (dsi > gap_at ? "gap" : "overlap") << " at " << gap_at << ", restarted at " << dsi << endl;
+    return false;
+}
+
+double DataSink::sample_rate(const HPFFile& h, const int32_t ch)
+{
+    auto& ci = h.channelinfo[ch];
+    return ci.PerChannelSampleRate > 0.0 ? ci.PerChannelSampleRate : ci.TimeIncrement > 0.0 ? 1.0 / ci.TimeIncrement : 1.0;
+}
+
+void DataSink::need_readings(const HPFFile& h, const vector<int32_t>& chans, const int32_t n, const char* hint)
+{
+    for (auto c : chans)
+        if (static_cast<int32_t>(h.channeldata[c].data.size()) < n) {
+            cerr << "*** channel " << h.channelinfo[c].Name << " runs at a different rate from " << h.channelinfo[chans[0]].Name
+                << "; " << hint << endl;
+            exit(1);
+        }
+}
+
+void DataSink::need_readings(const HPFFile& h, const int32_t n, const char* hint)
+{
+    for (auto& c : h.channeldata)
+        if (static_cast<int32_t>(c.data.size()) < n) {
+            cerr << "*** channel " << h.channelinfo[c._index].Name << " runs at a different rate from " << h.channelinfo[0].Name
+                << "; " << hint << endl;
+            exit(1);
+        }
+}
+
+
+
+class TriggerSink : public DataSink
+{
+    ////
+    //// TriggerSink finds level crossings on one channel, with hysteresis, and writes the rows from pre samples
+    //// before to post samples after each crossing to cout.  Overlapping windows are merged.  Crossings are
+    //// optionally listed to a separate events stream
+    ////
+
+    public:
+
+        const string cnm = "TriggerSink";
+        enum { rising = 1, falling = 2, both = 3 };
+
+        int32_t  ch;
+        int      edge;
+        int64_t  pre, post;
+        ostream* events;  // crossing list, may be null
+
+    private:
+
+        HPFFile::CountRange high, low;  // counts above the upper and below the lower hysteresis threshold
+        int      state         = 0;     // 0 unknown, 1 low, 2 high
+        int64_t  triggers      = 0;
+        int64_t  emitted_end   = 0;     // one past the last sample written
+        int64_t  emit_until    = 0;     // write samples before this
+        int64_t  hist_start    = 0;     // sample number of history[*][0]
+        vector<vector<int16_t>> history;  // up to pre samples per channel preceding the current chunk
+
+    public:
+
+        TriggerSink(HPFFile& h, const int32_t c, const double level, const double hysteresis,
+                    const int e, const int64_t pr, const int64_t po, ostream* ev)
+            : ch(c), edge(e), pre(pr), post(po), events(ev)
+        {
+            high = h.count_range(ch, ">=", level + hysteresis / 2);
+            low  = h.count_range(ch, hysteresis > 0 ? "<=" : "<", level - hysteresis / 2);
+            history.resize(h.numberofchannels);
+            if (events)
+                *events << "Trigger" << DEFAULT_SEP << "Sample" << DEFAULT_SEP << "Time(s)" << DEFAULT_SEP
+                    << "Edge" << DEFAULT_SEP << h.channelinfo[ch].Name << endl;
+        }
+
+        void row(HPFFile& h, stringstream& ss, const int64_t sample, const int16_t* const* col, const int64_t i)
+        {
+            ss << triggers << DEFAULT_SEP << sample;
+            for (auto j = 0; j < h.numberofchannels; ++j)
+                ss << DEFAULT_SEP << setprecision(15) << h.channelinfo[j].interpret(col[j][i]);
+            ss << endl;
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            if (! header_done) {
+                cout << "Trigger" << DEFAULT_SEP << "Sample";
+                for (auto& c : h.channelinfo)
+                    cout << DEFAULT_SEP << c.Name;
+                cout << endl;
+                header_done = true;
+            }
+            need_readings(h, n, "--trigger writes rows of every channel, so needs them all at one rate");
+            if (! follows(h, cnm, dsi, n)) {  // nothing before the gap is history, and no crossing spans it
+                for (auto& hv : history)
+                    hv.clear();
+                hist_start = dsi;
+                state = 0;
+                emitted_end = emit_until = dsi;
+            }
+            const int16_t* d = &h.channeldata[ch].data[0];
+            vector<const int16_t*> col(h.numberofchannels), hcol(h.numberofchannels);
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                col[j] = &h.channeldata[j].data[0];
+                hcol[j] = history[j].data();
+            }
+            // classify every sample against both thresholds first, a pass the compiler can vectorise
+            vector<uint8_t> cls(n);
+            for (auto i = 0; i < n; ++i)
+                cls[i] = (((d[i] >= high.lo) & (d[i] <= high.hi)) << 1) | ((d[i] >= low.lo) & (d[i] <= low.hi));
+            const int64_t hist_end = hist_start + static_cast<int64_t>(history[0].size());
+            stringstream ss;
+            if (emitted_end < dsi - pre)
+                emitted_end = dsi - pre;  // never reach back beyond the history
+            for (int64_t i = 0; i < n; ++i) {
+                int64_t t = dsi + i;
+                int next = (cls[i] & 2) ? 2 : (cls[i] & 1) ? 1 : state;
+                if (state && next != state && ((next == 2 && (edge & rising)) || (next == 1 && (edge & falling)))) {
+                    ++triggers;
+                    if (events)
+                        *events << triggers << DEFAULT_SEP << t << DEFAULT_SEP << setprecision(15) << t * h.channelinfo[ch].TimeIncrement
+                            << DEFAULT_SEP << (next == 2 ? "rising" : "falling")
+                            << DEFAULT_SEP << h.channelinfo[ch].interpret(d[i]) << endl;
+                    int64_t from = std::max(t - pre, emitted_end);
+                    for (auto k = std::max(from, hist_start); k < std::min(dsi, hist_end); ++k)  // pre-trigger samples from earlier chunks
+                        row(h, ss, k, hcol.data(), k - hist_start);
+                    for (auto k = std::max(from, dsi); k < t; ++k)
+                        row(h, ss, k, col.data(), k - dsi);
+                    emitted_end = std::max(emitted_end, t);
+                    emit_until = std::max(emit_until, t + post + 1);
+                }
+                state = next;
+                if (t < emit_until && t >= emitted_end) {
+                    row(h, ss, t, col.data(), i);
+                    emitted_end = t + 1;
+                }
+            }
+            cout << ss.str();
+            // keep the last pre samples for the next chunk's pre-trigger windows
+            if (pre > 0) {
+                int64_t keep_from = std::max(hist_start, dsi + n - pre);
+                for (auto j = 0; j < h.numberofchannels; ++j) {
+                    auto& hv = history[j];
+                    vector<int16_t> nv;
+                    for (auto k = keep_from; k < dsi; ++k)
+                        if (k >= hist_start && k - hist_start < static_cast<int64_t>(hv.size()))
+                            nv.push_back(hv[k - hist_start]);
+                    for (auto k = std::max(keep_from, dsi); k < dsi + n; ++k)
+                        nv.push_back(col[j][k - dsi]);
+                    hv.swap(nv);
+                }
+                hist_start = std::max(keep_from, dsi + n - static_cast<int64_t>(history[0].size()));
+            }
+        }
+
+        void finish(HPFFile& h) override
+        {
+            if (h.debug)
+                cerr << cnm << ": " << triggers << " triggers" << endl;
+        }
+};
+
+
+
+
+class FFT
+{
+    ////
+    //// FFT is an in-place iterative radix-2 complex FFT of a fixed power-of-two size, with the twiddle
+    //// factors and bit-reversal permutation computed once
+    ////
+
+    public:
+
+        const size_t n;
+
+    private:
+
+        vector<complex<double>> twiddle;
+        vector<uint32_t>        bitrev;
+
+    public:
+
+        FFT(const size_t size)
+            : n(size), twiddle(size / 2), bitrev(size)
+        {
+            if (n < 2 || (n & (n - 1))) { cerr << "*** FFT size must be a power of two, not " << n << endl; exit(1); }
+            int bits = 0;
+            while ((size_t(1) << bits) < n) ++bits;
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t r = 0;
+                for (auto b = 0; b < bits; ++b)
+                    r |= ((i >> b) & 1) << (bits - 1 - b);
+                bitrev[i] = r;
+            }
+            for (size_t k = 0; k < n / 2; ++k)
+                twiddle[k] = std::polar(1.0, -2.0 * M_PI * k / n);
+        }
+
+        void transform(vector<complex<double>>& x) const
+        {
+            for (size_t i = 0; i < n; ++i)
+                if (i < bitrev[i])
+                    std::swap(x[i], x[bitrev[i]]);
+            for (size_t len = 2; len <= n; len <<= 1) {
+                size_t half = len / 2, step = n / len;
+                for (size_t i = 0; i < n; i += len) {
+                    for (size_t k = 0; k < half; ++k) {
+                        auto t = twiddle[k * step] * x[i + k + half];
+                        x[i + k + half] = x[i + k] - t;
+                        x[i + k] += t;
+                    }
+                }
+            }
+        }
+};
+
+
+class PsdSink : public DataSink
+{
+    ////
+    //// PsdSink estimates the one-sided power spectral density of each selected channel by Welch's method:
+    //// Hann-windowed, mean-removed segments of nfft readings overlapping by overlap readings are transformed
+    //// and their periodograms averaged.  With block > 0, a spectrum is written for each block readings
+    //// (a spectrogram), otherwise one spectrum for the whole recording at finish().  Memory is O(nfft x channels)
+    ////
+
+    public:
+
+        const string cnm = "PsdSink";
+
+        vector<int32_t> chans;
+        size_t          nfft;
+        size_t          hop;
+        int64_t         block;
+
+    private:
+
+        FFT                     fft;
+        vector<double>          window;
+        double                  scale;        // periodogram to density, one-sided doubling applied separately
+        vector<vector<double>>  seg;          // per selected channel, readings not yet in a complete segment
+        vector<vector<double>>  acc;          // per selected channel, summed periodograms
+        vector<complex<double>> work;
+        int64_t                 segments = 0;
+        int64_t                 block_start = 0;
+        int64_t                 block_origin = 0;  // datastartindex of the first chunk, where blocks are counted from
+        int64_t                 empty_blocks = 0;  // blocks too short or broken for a single segment, reported at finish()
+        double                  fs = 0.0;
+
+    public:
+
+        PsdSink(HPFFile& h, const vector<int32_t>& c, const size_t n, const size_t overlap, const int64_t b)
+            : chans(c), nfft(n), hop(n - std::min(overlap, n - 1)), block(b), fft(n), window(n), seg(c.size()),
+              acc(c.size(), vector<double>(n / 2 + 1, 0.0)), work(n)
+        {
+            double w2 = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / n);  // periodic Hann
+                w2 += window[i] * window[i];
+            }
+            fs = sample_rate(h, chans[0]);
+            scale = 1.0 / (fs * w2);
+            for (auto& v : seg)
+                v.reserve(n);
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            need_readings(h, chans, n, "choose --psd channels at one rate");
+            if (expected < 0)
+                block_origin = block_start = dsi;
+            if (! follows(h, cnm, dsi, n)) {  // a gap: segments never span it, and blocks stay on the first one's grid
+                for (auto& v : seg) v.clear();
+                if (block > 0) {
+                    if (segments)
+                        output(h, block_start);
+                    int64_t b = (dsi - block_origin) / block;
+                    if (dsi < block_origin + b * block)
+                        --b;
+                    block_start = block_origin + b * block;
+                }
+            }
+            for (int32_t i = 0; i < n; ) {
+                // take as many readings as complete the current segment, or reach the end of the block
+                int32_t take = std::min<int64_t>(n - i, nfft - seg[0].size());
+                if (block > 0)
+                    take = std::min<int64_t>(take, block_start + block - (dsi + i));
+                for (size_t c = 0; c < chans.size(); ++c) {
+                    auto& ci = h.channelinfo[chans[c]];
+                    const int16_t* d = &h.channeldata[chans[c]].data[i];
+                    for (auto k = 0; k < take; ++k)
+                        seg[c].push_back(ci.interpret(d[k]));
+                }
+                i += take;
+                if (seg[0].size() == nfft)
+                    segment();
+                if (block > 0 && dsi + i >= block_start + block) {
+                    if (segments)
+                        output(h, block_start);
+                    else
+                        ++empty_blocks;
+                    block_start += block;
+                    for (auto& v : seg) v.clear();
+                }
+            }
+        }
+
+        void finish(HPFFile& h) override
+        {
+            if (block <= 0 || segments)
+                output(h, block_start);
+            if (empty_blocks)
+                cerr << cnm << ": *** " << empty_blocks << " blocks with fewer than " << nfft << " contiguous readings, no spectrum for them" << endl;
+        }
+
+    private:
+
+        void segment()
+        {
+            for (size_t c = 0; c < chans.size(); ++c) {
+                auto& v = seg[c];
+                double mean = 0.0;
+                for (auto x : v) mean += x;
+                mean /= nfft;
+                for (size_t k = 0; k < nfft; ++k)
+                    work[k] = complex<double>((v[k] - mean) * window[k], 0.0);
+                fft.transform(work);
+                auto& a = acc[c];
+                for (size_t k = 0; k <= nfft / 2; ++k)
+                    a[k] += std::norm(work[k]);
+                v.erase(v.begin(), v.begin() + hop);
+            }
+            ++segments;
+        }
+
+        void output(HPFFile& h, const int64_t start)
+        {
+            stringstream ss;
+            if (! header_done) {
+                if (block > 0)
+                    ss << "BlockStart(s)" << DEFAULT_SEP;
+                ss << "Frequency(Hz)";
+                for (auto c : chans)
+                    ss << DEFAULT_SEP << h.channelinfo[c].Name << "(" << h.channelinfo[c].out_unit << "^2/Hz)";
+                ss << endl;
+                header_done = true;
+            }
+            if (! segments) {
+                cerr << cnm << ": *** fewer than " << nfft << " contiguous readings, no spectrum" << endl;
+                return;
+            }
+            for (size_t k = 0; k <= nfft / 2; ++k) {
+                if (block > 0)
+                    ss << setprecision(15) << start / fs << DEFAULT_SEP;
+                ss << setprecision(15) << k * fs / nfft;
+                double onesided = (k == 0 || k == nfft / 2) ? 1.0 : 2.0;
+                for (size_t c = 0; c < chans.size(); ++c)
+                    ss << DEFAULT_SEP << setprecision(15) << acc[c][k] * scale * onesided / segments;
+                ss << endl;
+            }
+            cout << ss.str();
+            for (auto& a : acc)
+                std::fill(a.begin(), a.end(), 0.0);
+            segments = 0;
+        }
+};
+
+
+
+class ToneSink : public DataSink
+{
+    ////
+    //// ToneSink tracks the amplitude and phase of a few frequencies on each selected channel with streaming
+    //// Goertzel filters, writing one row per channel and frequency at the end of every window readings.
+    //// Work per reading is constant, two multiply-adds per frequency
+    ////
+
+    public:
+
+        const string cnm = "ToneSink";
+
+        vector<int32_t> chans;
+        vector<double>  freqs;
+        int64_t         window;
+
+    private:
+
+        vector<double> coeff, cosw, sinw, omega;    // per frequency
+        vector<double> s1, s2;                      // filter state, [channel * freqs.size() + frequency]
+        int64_t        count       = 0;             // readings in the current window
+        int64_t        win_start   = 0;
+        double         fs          = 0.0;
+
+    public:
+
+        ToneSink(HPFFile& h, const vector<int32_t>& c, const vector<double>& f, const int64_t w)
+            : chans(c), freqs(f), window(w), s1(c.size() * f.size(), 0.0), s2(c.size() * f.size(), 0.0)
+        {
+            fs = sample_rate(h, chans[0]);
+            if (window <= 0)
+                window = std::max<int64_t>(1, llround(fs));  // one second
+            for (auto x : freqs) {
+                if (x <= 0.0 || x >= fs / 2) { cerr << "*** tone frequency " << x << " must be between 0 and " << fs / 2 << endl; exit(1); }
+                double w = 2.0 * M_PI * x / fs;
+                omega.push_back(w);
+                coeff.push_back(2.0 * cos(w));
+                cosw.push_back(cos(w));
+                sinw.push_back(sin(w));
+            }
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            need_readings(h, chans, n, "use --channels to choose channels at one rate");
+            if (expected < 0)
+                win_start = dsi;
+            if (! follows(h, cnm, dsi, n))
+                reset(dsi);
+            const size_t nf = freqs.size();
+            for (int32_t i = 0; i < n; ) {
+                int32_t take = std::min<int64_t>(n - i, window - count);
+                for (size_t c = 0; c < chans.size(); ++c) {
+                    auto& ci = h.channelinfo[chans[c]];
+                    const int16_t* d = &h.channeldata[chans[c]].data[i];
+                    for (size_t f = 0; f < nf; ++f) {
+                        double a = s1[c * nf + f], b = s2[c * nf + f], k = coeff[f];
+                        for (auto j = 0; j < take; ++j) {
+                            double s0 = ci.interpret(d[j]) + k * a - b;
+                            b = a;
+                            a = s0;
+                        }
+                        s1[c * nf + f] = a;
+                        s2[c * nf + f] = b;
+                    }
+                }
+                i += take;
+                count += take;
+                if (count == window) {
+                    output(h);
+                    reset(win_start + window);
+                }
+            }
+        }
+
+    private:
+
+        void reset(const int64_t start)
+        {
+            std::fill(s1.begin(), s1.end(), 0.0);
+            std::fill(s2.begin(), s2.end(), 0.0);
+            count = 0;
+            win_start = start;
+        }
+
+        void output(HPFFile& h)
+        {
+            stringstream ss;
+            if (! header_done) {
+                ss << "WindowStart(s)" << DEFAULT_SEP << "Channel" << DEFAULT_SEP << "Frequency(Hz)"
+                    << DEFAULT_SEP << "Amplitude" << DEFAULT_SEP << "Phase(deg)" << endl;
+                header_done = true;
+            }
+            const size_t nf = freqs.size();
+            for (size_t c = 0; c < chans.size(); ++c) {
+                for (size_t f = 0; f < nf; ++f) {
+                    // y[N-1] = s1 - e^{-jw} s2 = e^{jw(N-1)} X(w), so rotate back to the window start
+                    double a = s1[c * nf + f], b = s2[c * nf + f];
+                    complex<double> y(a - b * cosw[f], b * sinw[f]);
+                    auto X = y * std::polar(1.0, -omega[f] * (count - 1));
+                    ss << setprecision(15) << win_start / fs
+                        << DEFAULT_SEP << h.channelinfo[chans[c]].Name
+                        << DEFAULT_SEP << freqs[f]
+                        << DEFAULT_SEP << 2.0 * std::abs(X) / count
+                        << DEFAULT_SEP << std::arg(X) * 180.0 / M_PI << endl;
+                }
+            }
+            cout << ss.str();
+        }
+};
+
+
+
+class QcSink : public DataSink
+{
+    ////
+    //// QcSink reports data quality problems found in one pass: gaps and overlaps in datastartindex between
+    //// data chunks, runs of readings pinned at RangeMin or RangeMax, runs of more than flat identical
+    //// readings, and steps of at least step output units between successive readings.  Each chunk column is first
+    //// reduced to byte masks in loops the compiler vectorises; only the masks are walked serially.  At most
+    //// list_max problems of each kind per channel are listed, all are counted
+    ////
+
+    public:
+
+        const string cnm = "QcSink";
+        static const int64_t list_max = 100;
+
+        int64_t flat;
+        double  step;
+
+    private:
+
+        typedef struct ChannelState {
+            int16_t last;
+            bool    have_last  = false;
+            int64_t clip_start = -1, clip_len = 0;
+            int64_t flat_start = -1, flat_len = 0;
+            int16_t flat_value = 0;    // the reading held through the current flat run
+            int32_t step_counts;       // step in counts, 0 if not checked or judged through a thermocouple table
+            int64_t clip_runs = 0, clipped = 0, flat_runs = 0, flat_longest = 0, steps = 0;
+            int64_t clip_listed = 0, flat_listed = 0, step_listed = 0;
+        } ChannelState;
+        vector<ChannelState> st;
+        int64_t              gaps = 0, gap_listed = 0, chunks = 0;
+        stringstream         list;
+
+    public:
+
+        QcSink(HPFFile& h, const int64_t f, const double s)
+            : flat(f), step(s), st(h.numberofchannels)
+        {
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                auto sc = std::abs(h.channelinfo[j].out_scale);
+                st[j].step_counts = (step > 0.0 && sc > 0.0 && ! h.channelinfo[j].lut) ? std::max<int64_t>(1, llround(ceil(step / sc))) : 0;
+            }
+            list << "Check" << DEFAULT_SEP << "Channel" << DEFAULT_SEP << "StartSample" << DEFAULT_SEP
+                << "Length" << DEFAULT_SEP << "Value" << endl;
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            need_readings(h, n, "--qc checks gaps by datastartindex, so needs every channel at one rate");
+            ++chunks;
+            if (! follows(h, cnm, dsi, n)) {
+                if (gap_listed++ < list_max)
+                    list << (dsi > gap_at ? "gap" : "overlap") << DEFAULT_SEP << "-" << DEFAULT_SEP << gap_at
+                        << DEFAULT_SEP << dsi - gap_at << DEFAULT_SEP << "" << endl;
+                ++gaps;
+                for (auto j = 0; j < h.numberofchannels; ++j) {  // runs and steps do not continue across a gap
+                    close_clip(h, j);
+                    close_flat(h, j);
+                    st[j].have_last = false;
+                }
+            }
+            vector<uint8_t> clip(n), same(n), jump(n);
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                auto& c = st[j];
+                auto& ci = h.channelinfo[j];
+                const int16_t* d = &h.channeldata[j].data[0];
+                const int16_t lo = ci.RangeMin, hi = ci.RangeMax;
+                const int32_t sc = c.step_counts;
+                for (auto i = 0; i < n; ++i)
+                    clip[i] = (d[i] <= lo) | (d[i] >= hi);
+                same[0] = c.have_last && d[0] == c.last;
+                for (auto i = 1; i < n; ++i)
+                    same[i] = d[i] == d[i - 1];
+                if (ci.lut && step > 0.0) {  // no one scale: steps are judged in the table's temperatures, never across NaN
+                    const double* tc = &(*ci.lut)[32768];
+                    jump[0] = c.have_last && std::abs(tc[d[0]] - tc[c.last]) >= step;
+                    for (auto i = 1; i < n; ++i)
+                        jump[i] = std::abs(tc[d[i]] - tc[d[i - 1]]) >= step;
+                } else {
+                    jump[0] = c.have_last && sc && std::abs(d[0] - c.last) >= sc;
+                    for (auto i = 1; i < n; ++i)
+                        jump[i] = sc && std::abs(d[i] - d[i - 1]) >= sc;
+                }
+                for (int64_t i = 0; i < n; ++i) {
+                    int64_t t = dsi + i;
+                    if (clip[i]) {
+                        if (! c.clip_len) c.clip_start = t;
+                        ++c.clip_len;
+                        ++c.clipped;
+                    } else if (c.clip_len) {
+                        close_clip(h, j);
+                    }
+                    if (same[i]) {
+                        if (! c.flat_len) { c.flat_start = t - 1; c.flat_len = 1; c.flat_value = d[i]; }
+                        ++c.flat_len;
+                    } else if (c.flat_len) {
+                        close_flat(h, j);
+                    }
+                    if (jump[i]) {
+                        int16_t prev = i ? d[i - 1] : c.last;
+                        if (c.step_listed++ < list_max)
+                            list << "step" << DEFAULT_SEP << ci.Name << DEFAULT_SEP << t << DEFAULT_SEP << 1 << DEFAULT_SEP
+                                << setprecision(15) << ci.interpret(d[i]) - ci.interpret(prev) << endl;
+                        ++c.steps;
+                    }
+                }
+                c.last = d[n - 1];
+                c.have_last = true;
+            }
+        }
+
+        void finish(HPFFile& h) override
+        {
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                close_clip(h, j);
+                close_flat(h, j);
+            }
+            stringstream ss;
+            ss << list.str() << "" << DEFAULT_SEP << "" << endl;
+            ss << "DataChunks :" << DEFAULT_SEP << chunks << endl
+                << "GapsAndOverlaps :" << DEFAULT_SEP << gaps << endl
+                << "FlatRunMinimum :" << DEFAULT_SEP << flat << endl
+                << "StepMinimum :" << DEFAULT_SEP << (step > 0.0 ? step : 0.0) << endl
+                << "" << DEFAULT_SEP << "" << endl;
+            ss << "Channel" << DEFAULT_SEP << "ClippedReadings" << DEFAULT_SEP << "ClippedRuns" << DEFAULT_SEP
+                << "FlatRuns" << DEFAULT_SEP << "LongestFlatRun" << DEFAULT_SEP << "Steps" << endl;
+            for (auto j = 0; j < h.numberofchannels; ++j)
+                ss << h.channelinfo[j].Name << DEFAULT_SEP << st[j].clipped << DEFAULT_SEP << st[j].clip_runs
+                    << DEFAULT_SEP << st[j].flat_runs << DEFAULT_SEP << st[j].flat_longest << DEFAULT_SEP << st[j].steps << endl;
+            cout << ss.str();
+        }
+
+    private:
+
+        void close_clip(HPFFile& h, const int32_t j)
+        {
+            auto& c = st[j];
+            if (! c.clip_len)
+                return;
+            if (c.clip_listed++ < list_max)
+                list << "clip" << DEFAULT_SEP << h.channelinfo[j].Name << DEFAULT_SEP << c.clip_start << DEFAULT_SEP
+                    << c.clip_len << DEFAULT_SEP << "" << endl;
+            ++c.clip_runs;
+            c.clip_len = 0;
+        }
+
+        void close_flat(HPFFile& h, const int32_t j)
+        {
+            auto& c = st[j];
+            if (! c.flat_len)
+                return;
+            if (c.flat_len > flat) {
+                if (c.flat_listed++ < list_max)
+                    list << "flat" << DEFAULT_SEP << h.channelinfo[j].Name << DEFAULT_SEP << c.flat_start << DEFAULT_SEP
+                        << c.flat_len << DEFAULT_SEP << setprecision(15) << h.channelinfo[j].interpret(c.flat_value) << endl;
+                ++c.flat_runs;
+                c.flat_longest = std::max(c.flat_longest, c.flat_len);
+            }
+            c.flat_len = 0;
+        }
+};
+
+
+
+class CompressSink : public DataSink
+{
+    ////
+    //// CompressSink writes historian-style long-format (sample, time, channel, value) points, only when a
+    //// channel leaves a deadband around its last written value, or with swinging-door compression when a
+    //// straight line from the last written point can no longer pass within the tolerance of every reading
+    //// since.  Tolerances are per channel in output units, converted once to counts, through the steepest
+    //// step of a thermocouple table; compressor state carries across chunks.
+    //// Points are sorted by sample within each chunk's output
+    ////
+
+    public:
+
+        const string cnm = "CompressSink";
+        enum { deadband, swingingdoor };
+
+        int method;
+
+    private:
+
+        typedef struct Point {
+            int64_t t;
+            int32_t ch;
+            double  v;  // counts, not necessarily a whole number for swinging door
+        } Point;
+        typedef struct ChannelState {
+            double  tol;                      // tolerance in counts
+            bool    started   = false;
+            int64_t t0;                       // last written point
+            double  v0;
+            int64_t tp;                       // previous reading
+            int16_t vp;
+            double  slope_hi, slope_lo;       // swinging door: the doors' slopes from the last written point
+        } ChannelState;
+        vector<ChannelState> st;
+        vector<Point>        out;
+        int64_t              points = 0, readings = 0;
+
+    public:
+
+        CompressSink(HPFFile& h, const int m, const vector<double>& tol)
+            : method(m), st(h.numberofchannels)
+        {
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                auto& ci = h.channelinfo[j];
+                auto sc = std::abs(ci.out_scale);
+                if (ci.lut) {  // no one scale: bound a count by the table's steepest step
+                    sc = 0.0;
+                    for (size_t k = 1; k < ci.lut->size(); ++k)
+                        sc = std::max(sc, std::abs((*ci.lut)[k] - (*ci.lut)[k - 1]));  // keeps sc over NaN
+                }
+                st[j].tol = sc > 0.0 ? tol[j] / sc : 0.0;
+            }
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            need_readings(h, n, "--compress numbers every channel's readings by datastartindex, so needs them all at one rate");
+            if (! follows(h, cnm, dsi, n))
+                for (auto j = 0; j < h.numberofchannels; ++j)
+                    restart(j);  // close each line at the last reading before the gap
+            readings += n;
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                auto& c = st[j];
+                const int16_t* d = &h.channeldata[j].data[0];
+                int32_t i = 0;
+                if (! c.started) {
+                    emit(dsi, j, d[0]);
+                    c.started = true;
+                    c.tp = dsi;
+                    c.vp = d[0];
+                    c.slope_hi = std::numeric_limits<double>::infinity();
+                    c.slope_lo = -std::numeric_limits<double>::infinity();
+                    i = 1;
+                }
+                if (method == deadband) {
+                    const double lo = c.v0 - c.tol, hi = c.v0 + c.tol;
+                    for (; i < n; ++i) {
+                        if (d[i] < lo || d[i] > hi) {
+                            emit(dsi + i, j, d[i]);
+                            continue_deadband(c, d, i, n, dsi, j);
+                            break;
+                        }
+                    }
+                } else {
+                    for (; i < n; ++i)
+                        swing(c, j, dsi + i, d[i]);
+                }
+                c.tp = dsi + n - 1;
+                c.vp = d[n - 1];
+            }
+            flush(h);
+        }
+
+        void finish(HPFFile& h) override
+        {
+            for (auto j = 0; j < h.numberofchannels; ++j)
+                restart(j);
+            flush(h);
+            if (h.debug)
+                cerr << cnm << ": " << points << " points written for " << readings * h.numberofchannels << " readings" << endl;
+        }
+
+    private:
+
+        void emit(const int64_t t, const int32_t ch, const double v)
+        {
+            out.push_back({ t, ch, v });
+            st[ch].t0 = t;
+            st[ch].v0 = v;
+        }
+
+        void continue_deadband(ChannelState& c, const int16_t* d, int32_t i, const int32_t n, const int64_t dsi, const int32_t j)
+        {   // continue the deadband scan after a point is written, with the band moved to the new value
+            for (++i; i < n; ++i) {
+                if (d[i] < c.v0 - c.tol || d[i] > c.v0 + c.tol)
+                    emit(dsi + i, j, d[i]);
+            }
+        }
+
+        void swing(ChannelState& c, const int32_t j, const int64_t t, const int16_t v)
+        {
+            double dt = static_cast<double>(t - c.t0);
+            double hi = (v + c.tol - c.v0) / dt, lo = (v - c.tol - c.v0) / dt;
+            double shi = std::min(c.slope_hi, hi), slo = std::max(c.slope_lo, lo);
+            if (slo > shi) {  // the doors have crossed: write the previous reading and swing from there
+                emit(c.tp, j, door_value(c));
+                dt = static_cast<double>(t - c.t0);
+                shi = (v + c.tol - c.v0) / dt;
+                slo = (v - c.tol - c.v0) / dt;
+            }
+            c.slope_hi = shi;
+            c.slope_lo = slo;
+            c.tp = t;
+            c.vp = v;
+        }
+
+        double door_value(const ChannelState& c) const
+        {   // the previous reading, moved onto the nearest door if it lies outside them, so every reading
+            // since the last written point stays within tolerance of the line between them
+            double s = (c.vp - c.v0) / static_cast<double>(c.tp - c.t0);
+            s = std::max(c.slope_lo, std::min(c.slope_hi, s));
+            return c.v0 + s * (c.tp - c.t0);
+        }
+
+        void restart(const int32_t j)
+        {
+            auto& c = st[j];
+            if (c.started && c.tp != c.t0)
+                emit(c.tp, j, method == swingingdoor ? door_value(c) : c.vp);
+            c.started = false;
+        }
+
+        void flush(HPFFile& h)
+        {
+            stringstream ss;
+            if (! header_done) {
+                ss << "Sample" << DEFAULT_SEP << "Time(s)" << DEFAULT_SEP << "Channel" << DEFAULT_SEP << "Value" << endl;
+                header_done = true;
+            }
+            std::stable_sort(out.begin(), out.end(), [](const Point& a, const Point& b) { return a.t < b.t; });
+            for (auto& p : out) {
+                auto& ci = h.channelinfo[p.ch];
+                ss << p.t << DEFAULT_SEP << setprecision(15) << p.t * ci.TimeIncrement << DEFAULT_SEP << ci.Name
+                    << DEFAULT_SEP << ci.interpret_at(p.v) << endl;
+            }
+            points += out.size();
+            out.clear();
+            cout << ss.str();
+        }
+};
+
+
+
+class LttbSink : public DataSink
+{
+    ////
+    //// LttbSink downsamples each selected channel to about target points by largest-triangle-three-buckets,
+    //// which keeps the spikes that every-Nth decimation misses.  The total reading count comes from the
+    //// index, so buckets are fixed up front and a single pass holds just two buckets per channel: the
+    //// bucket being chosen from, and the following bucket whose average is the triangle's third corner.
+    //// Channels of each chunk are processed in parallel
+    ////
+
+    public:
+
+        const string cnm = "LttbSink";
+
+        vector<int32_t> chans;
+        int64_t         target;
+        int64_t         total;
+
+    private:
+
+        typedef struct Point {
+            int64_t t;
+            int16_t v;
+        } Point;
+        typedef struct ChannelState {
+            int64_t       seen = 0;      // readings so far
+            int64_t       bucket = 0;    // bucket being filled with next[]
+            Point         a;             // last selected point
+            vector<Point> cur, next;     // bucket to choose from, and the bucket after it
+            vector<Point> out;           // points selected during the current chunk
+        } ChannelState;
+        vector<ChannelState> st;
+        double               every;
+        unsigned             nthreads;
+
+    public:
+
+        LttbSink(HPFFile&, const vector<int32_t>& c, const int64_t n, const int64_t tot)
+            : chans(c), target(std::max<int64_t>(n, 3)), total(tot), st(c.size())
+        {
+            every = (total > target) ? static_cast<double>(total - 2) / (target - 2) : 0.0;
+            nthreads = std::max(1u, std::min<unsigned>(std::thread::hardware_concurrency(), chans.size()));
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            need_readings(h, chans, n, "use --channels to choose channels at one rate");
+            auto work = [this, &h, dsi, n](size_t b) {
+                for (size_t c = b; c < chans.size(); c += nthreads)
+                    channel(st[c], &h.channeldata[chans[c]].data[0], dsi, n);
+            };
+            if (nthreads > 1 && static_cast<int64_t>(n) * chans.size() >= 65536) {
+                vector<std::thread> threads;
+                for (unsigned b = 0; b < nthreads; ++b)
+                    threads.emplace_back(work, b);
+                for (auto& t : threads)
+                    t.join();
+            } else {
+                for (unsigned b = 0; b < nthreads; ++b)
+                    work(b);
+            }
+            output(h);
+        }
+
+        void finish(HPFFile& h) override
+        {
+            for (auto& c : st) {  // only reached if the index overstated the readings
+                if (c.cur.size() || c.next.size()) {
+                    c.cur.insert(c.cur.end(), c.next.begin(), c.next.end());
+                    c.out.push_back(c.cur.back());
+                }
+            }
+            output(h);
+        }
+
+    private:
+
+        int64_t bucket_of(const int64_t p) const
+        {   // buckets 0 .. target-3 hold readings 1 .. total-2; reading 0 is bucket -1 and total-1 is bucket target-2
+            if (p == 0) return -1;
+            if (p >= total - 1) return target - 2;
+            // bucket i holds readings floor(i * every) + 1 up to floor((i + 1) * every)
+            auto i = static_cast<int64_t>((p - 1) / every);
+            if (static_cast<int64_t>((i + 1) * every) <= p - 1)
+                ++i;
+            return std::min<int64_t>(i, target - 3);
+        }
+
+        void select(ChannelState& c)
+        {   // choose from cur the point making the largest triangle with a and the average of next
+            double cx = 0.0, cy = 0.0;
+            for (auto& q : c.next) { cx += q.t; cy += q.v; }
+            cx /= c.next.size();
+            cy /= c.next.size();
+            double best = -1.0;
+            Point pick = c.cur[0];
+            for (auto& q : c.cur) {
+                double area = std::abs((c.a.t - cx) * (q.v - c.a.v) - (c.a.t - q.t) * (cy - c.a.v));
+                if (area > best) { best = area; pick = q; }
+            }
+            c.out.push_back(pick);
+            c.a = pick;
+        }
+
+        void channel(ChannelState& c, const int16_t* d, const int64_t dsi, const int32_t n)
+        {
+            for (int32_t i = 0; i < n; ++i, ++c.seen) {
+                Point q = { dsi + i, d[i] };
+                if (every == 0.0) {  // fewer readings than points wanted
+                    c.out.push_back(q);
+                    continue;
+                }
+                auto b = bucket_of(c.seen);
+                if (b < 0) {
+                    c.a = q;
+                    c.out.push_back(q);
+                    c.bucket = 0;
+                    continue;
+                }
+                if (b != c.bucket) {  // next[] is complete
+                    if (c.cur.size())
+                        select(c);
+                    c.cur.swap(c.next);
+                    c.next.clear();
+                    c.bucket = b;
+                }
+                c.next.push_back(q);
+                if (b == target - 2) {  // the last reading is always kept
+                    if (c.cur.size())
+                        select(c);
+                    c.out.push_back(q);
+                    c.cur.clear();
+                    c.next.clear();
+                }
+            }
+        }
+
+        void output(HPFFile& h)
+        {
+            stringstream ss;
+            if (! header_done) {
+                ss << "Sample" << DEFAULT_SEP << "Time(s)" << DEFAULT_SEP << "Channel" << DEFAULT_SEP << "Value" << endl;
+                header_done = true;
+            }
+            for (size_t c = 0; c < chans.size(); ++c) {
+                auto& ci = h.channelinfo[chans[c]];
+                for (auto& q : st[c].out)
+                    ss << q.t << DEFAULT_SEP << setprecision(15) << q.t * ci.TimeIncrement << DEFAULT_SEP << ci.Name
+                        << DEFAULT_SEP << ci.interpret(q.v) << endl;
+                st[c].out.clear();
+            }
+            cout << ss.str();
+        }
+};
+
+
+
+class AlignSink : public DataSink
+{
+    ////
+    //// AlignSink writes the table for channels recorded at different rates, resampling every channel onto a
+    //// common time base with zero-order hold (the latest reading at or before each time) or linear
+    //// interpolation.  Each channel's reading times come from its own StartTime and TimeIncrement.  Per-channel
+    //// cursors advance through small buffers holding only readings still needed, so memory stays bounded.
+    //// Output ends at the last time all channels have reached
+    ////
+
+    public:
+
+        const string cnm = "AlignSink";
+        enum { zoh, linear };
+
+        int    method;
+        double inc;      // output time increment, seconds
+
+    private:
+
+        typedef struct ChannelState {
+            double          start;         // seconds from the earliest channel's StartTime
+            double          inc;
+            int64_t         base = 0;      // reading number of buf[0]
+            vector<int16_t> buf;
+            bool            ended = false;
+        } ChannelState;
+        vector<ChannelState> st;
+        int64_t              m = 0;        // next output row
+        int64_t              rows = 0;
+
+    public:
+
+        AlignSink(HPFFile& h, const int mth, const double rate)
+            : method(mth), st(h.numberofchannels)
+        {
+            // channel start times relative to the earliest, done in whole seconds first to keep the fractions exact
+            vector<int64_t> secs(h.numberofchannels);
+            int64_t earliest = std::numeric_limits<int64_t>::max();
+            int32_t first = 0;
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                auto& t = h.channelinfo[j].StartTime;
+                secs[j] = HPFFile::TimeColumn::days_from_civil(t.y, t.m, t.d) * 86400 + t.h * 3600 + t.n * 60 + t.s;
+                if (secs[j] < earliest || (secs[j] == earliest && t.frac_s < h.channelinfo[first].StartTime.frac_s)) {
+                    earliest = secs[j];
+                    first = j;
+                }
+            }
+            double first_frac = h.channelinfo[first].StartTime.frac_s - h.channelinfo[first].StartTime.s;
+            inc = std::numeric_limits<double>::max();
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                auto& ci = h.channelinfo[j];
+                st[j].start = (secs[j] - earliest) + (ci.StartTime.frac_s - ci.StartTime.s) - first_frac;
+                st[j].inc = ci.TimeIncrement > 0.0 ? ci.TimeIncrement : 1.0 / ci.PerChannelSampleRate;
+                inc = std::min(inc, st[j].inc);
+            }
+            if (rate > 0.0)
+                inc = 1.0 / rate;
+            if (h.timecol.mode != HPFFile::TimeColumn::none)
+                h.timecol.setup(h.timecol.mode, h.channelinfo[first].StartTime, inc);
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            if (! follows(h, cnm, dsi, n) || gap_at < 0) {
+                // the first chunk, or one after a gap: each channel restarts at its reading for dsi, which counts
+                // the first channel's readings, and output restarts at the first time any channel has
+                double from = std::numeric_limits<double>::max();
+                for (auto j = 0; j < h.numberofchannels; ++j) {
+                    auto& c = st[j];
+                    c.buf.clear();
+                    c.base = n > 0 ? dsi * static_cast<int64_t>(h.channeldata[j].data.size()) / n : dsi;
+                    from = std::min(from, c.start + c.base * c.inc);
+                }
+                m = static_cast<int64_t>(ceil(from / inc - 1e-9));
+            }
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                auto& d = h.channeldata[j].data;
+                st[j].buf.insert(st[j].buf.end(), d.begin(), d.end());
+            }
+            emit(h);
+        }
+
+        void finish(HPFFile& h) override
+        {
+            if (h.debug)
+                cerr << cnm << ": " << rows << " rows written" << endl;
+        }
+
+    private:
+
+        int64_t reading_at(const ChannelState& c, const double t) const
+        {   // the latest reading at or before t, -1 if t is before the channel starts
+            return static_cast<int64_t>(floor((t - c.start) / c.inc + 1e-9));
+        }
+
+        void emit(HPFFile& h)
+        {
+            stringstream ss;
+            if (! header_done) {
+                if (h.timecol.mode != HPFFile::TimeColumn::none)
+                    ss << "Time" << DEFAULT_SEP;
+                for (auto j = 0; j < h.numberofchannels; ++j)
+                    ss << h.channelinfo[j].Name << (j < h.numberofchannels - 1 ? DEFAULT_SEP : "");
+                ss << endl;
+                header_done = true;
+            }
+            const int64_t need = (method == linear) ? 1 : 0;  // readings beyond the cursor that must be present
+            for (;; ++m) {
+                double t = m * inc;
+                bool ready = true;
+                for (auto& c : st) {
+                    auto k = std::max<int64_t>(reading_at(c, t), c.base);
+                    if (k + need >= c.base + static_cast<int64_t>(c.buf.size())) { ready = false; break; }
+                }
+                if (! ready)
+                    break;
+                if (h.do_downsample && m % h.downsample_count)
+                    continue;
+                ++rows;
+                if (h.timecol.mode != HPFFile::TimeColumn::none) {
+                    size_t len;
+                    const char* tc = h.timecol.format(m, len);
+                    ss.write(tc, len);
+                    ss << DEFAULT_SEP;
+                }
+                for (auto j = 0; j < h.numberofchannels; ++j) {
+                    auto& c = st[j];
+                    auto& ci = h.channelinfo[j];
+                    auto k = reading_at(c, t);
+                    double v;
+                    if (k < c.base) {
+                        v = ci.interpret(c.buf[0]);  // before this channel starts or restarts, hold its first reading
+                    } else if (method == zoh) {
+                        v = ci.interpret(c.buf[k - c.base]);
+                    } else {
+                        double f = (t - c.start) / c.inc - k;
+                        double a = ci.interpret(c.buf[k - c.base]), b = ci.interpret(c.buf[k + 1 - c.base]);
+                        v = a + (b - a) * f;
+                    }
+                    ss << setprecision(15) << v << (j < h.numberofchannels - 1 ? DEFAULT_SEP : "");
+                }
+                ss << endl;
+            }
+            // drop readings no later output time can need
+            double t = m * inc;
+            for (auto& c : st) {
+                auto k = std::max<int64_t>(reading_at(c, t), c.base);
+                auto drop = std::min<int64_t>(k - c.base, c.buf.size());
+                if (drop > 0) {
+                    c.buf.erase(c.buf.begin(), c.buf.begin() + drop);
+                    c.base += drop;
+                }
+            }
+            cout << ss.str();
+        }
+};
+
+
+
+class RollingSink : public DataSink
+{
+    ////
+    //// RollingSink writes the moving mean, RMS and standard deviation of the selected channels over the
+    //// last window readings, every hop readings.  Linearly converted channels keep exact integer sums of
+    //// counts and squared counts, so long windows never drift; channels converted through a table keep a
+    //// windowed Welford mean and sum of squared deviations, so a large mean does not cancel the variance.
+    //// Work per reading is constant, and windows carry across data chunks but restart at gaps
+    ////
+
+    public:
+
+        const string cnm = "RollingSink";
+
+        vector<int32_t> chans;
+        int64_t         window;
+        int64_t         hop;
+        bool            do_mean, do_rms, do_std;
+
+    private:
+
+        typedef struct ChannelState {
+            vector<int16_t> ring;           // the last window readings
+            int64_t         sum = 0;        // sum of counts in the window
+            int64_t         sum2 = 0;       // sum of squared counts in the window
+            int64_t         vn = 0;         // for table-converted channels, values in the window other than NaN,
+            double          vmean = 0.0;    // their mean
+            double          vm2 = 0.0;      // and their sum of squared deviations from it
+            int64_t         nans = 0;       // NaN values in the window
+        } ChannelState;
+        vector<ChannelState> st;
+        int64_t              filled      = 0;   // readings in the window, up to window
+        int64_t              oldest      = 0;   // ring position of the oldest reading
+        int64_t              since       = 0;   // readings since the last row
+
+    public:
+
+        RollingSink(HPFFile& h, const vector<int32_t>& c, const string& stats, const int64_t w, const int64_t hp)
+            : chans(c), window(w), hop(hp), do_mean(false), do_rms(false), do_std(false), st(c.size())
+        {
+            stringstream ss(stats);
+            string x;
+            while (getline(ss, x, ',')) {
+                if      (x == "mean") do_mean = true;
+                else if (x == "rms")  do_rms = true;
+                else if (x == "std")  do_std = true;
+                else { cerr << "*** --rolling statistics are mean, rms and std, not " << x << endl; exit(1); }
+            }
+            if (window <= 0)
+                window = std::max<int64_t>(1, llround(sample_rate(h, chans[0])));  // one second
+            if (hop <= 0)
+                hop = window;
+            for (auto& s : st)
+                s.ring.assign(window, 0);
+            reset();
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            if (! follows(h, cnm, dsi, n))
+                reset();
+            need_readings(h, chans, n, "use --channels to choose channels at one rate");
+            stringstream ss;
+            if (! header_done) {
+                ss << "Sample" << DEFAULT_SEP << "Time(s)";
+                for (auto c : chans) {
+                    auto& nm = h.channelinfo[c].Name;
+                    if (do_mean) ss << DEFAULT_SEP << nm << "_mean";
+                    if (do_rms)  ss << DEFAULT_SEP << nm << "_rms";
+                    if (do_std)  ss << DEFAULT_SEP << nm << "_std";
+                }
+                ss << endl;
+                header_done = true;
+            }
+            for (int32_t i = 0; i < n; ++i) {
+                const bool full = filled == window;
+                for (size_t c = 0; c < chans.size(); ++c) {
+                    auto& ci = h.channelinfo[chans[c]];
+                    auto& s = st[c];
+                    const int16_t in = h.channeldata[chans[c]].data[i];
+                    if (ci.lut) {
+                        if (full)
+                            remove_value(s, ci.interpret(s.ring[oldest]));
+                        add_value(s, ci.interpret(in));
+                    } else {
+                        if (full) {
+                            const int64_t out = s.ring[oldest];
+                            s.sum -= out;
+                            s.sum2 -= out * out;
+                        }
+                        s.sum += in;
+                        s.sum2 += static_cast<int64_t>(in) * in;
+                    }
+                    s.ring[oldest] = in;
+                }
+                if (++oldest == window)
+                    oldest = 0;
+                if (! full)
+                    ++filled;
+                if (filled == window && ++since >= hop) {
+                    row(h, ss, dsi + i);
+                    since = 0;
+                }
+            }
+            cout << ss.str();
+        }
+
+    private:
+
+        void reset()
+        {
+            for (auto& s : st) {
+                s.sum = s.sum2 = s.nans = s.vn = 0;
+                s.vmean = s.vm2 = 0.0;
+            }
+            filled = oldest = 0;
+            since = hop - 1;  // a row as soon as the window is first full
+        }
+
+        static void add_value(ChannelState& s, const double v)
+        {
+            if (std::isnan(v)) { ++s.nans; return; }
+            double d = v - s.vmean;
+            s.vmean += d / ++s.vn;
+            s.vm2 += d * (v - s.vmean);
+        }
+
+        static void remove_value(ChannelState& s, const double v)
+        {
+            if (std::isnan(v)) { --s.nans; return; }
+            if (--s.vn == 0) {
+                s.vmean = s.vm2 = 0.0;
+                return;
+            }
+            double d = v - s.vmean;
+            s.vmean -= d / s.vn;
+            s.vm2 -= d * (v - s.vmean);
+        }
+
+        void row(HPFFile& h, stringstream& ss, const int64_t sample)
+        {
+            ss << sample << DEFAULT_SEP << setprecision(15) << sample * h.channelinfo[chans[0]].TimeIncrement;
+            for (size_t c = 0; c < chans.size(); ++c) {
+                auto& ci = h.channelinfo[chans[c]];
+                auto& s = st[c];
+                double mean, var;
+                if (ci.lut) {
+                    if (s.nans) {
+                        mean = var = std::numeric_limits<double>::quiet_NaN();
+                    } else {
+                        mean = s.vmean;
+                        var = std::max(0.0, s.vm2 / window);
+                    }
+                } else {
+                    // window * sum2 - sum^2 is exact in 128 bits, so the variance has no cancellation
+                    __int128 d = static_cast<__int128>(window) * s.sum2 - static_cast<__int128>(s.sum) * s.sum;
+                    mean = static_cast<double>(s.sum) / window * ci.out_scale + ci.out_offset;
+                    var = static_cast<double>(d) / (static_cast<double>(window) * window) * ci.out_scale * ci.out_scale;
+                }
+                if (do_mean) ss << DEFAULT_SEP << mean;
+                if (do_rms)  ss << DEFAULT_SEP << sqrt(mean * mean + var);
+                if (do_std)  ss << DEFAULT_SEP << sqrt(var);
+            }
+            ss << endl;
+        }
+};
+
+
+
+class SpikeSink : public DataSink
+{
+    ////
+    //// SpikeSink flags readings further than k scaled MADs from the median of the window readings around
+    //// them on their channel (a Hampel filter), listing them and, as a pre-sink, replacing them with that
+    //// median before anything else sees the chunk.  The window is centred where the chunk allows, and
+    //// otherwise ends at the chunk's last reading.  Readings are int16 counts, so each channel keeps a
+    //// Fenwick tree of counts over all 65536 values: the median is an O(log) descent and the MAD an O(log^2)
+    //// search, both exact, with no re-sorting per reading.  Windows restart at gaps.  Listed samples and
+    //// times are the channel's own, so they are right for a channel slower than the first
+    ////
+
+    public:
+
+        const string cnm = "SpikeSink";
+
+        vector<int32_t> chans;
+        int64_t         window;
+        double          k;
+        bool            replace;
+        ostream*        list;        // where flagged readings are listed, may be nullptr
+
+    private:
+
+        typedef struct ChannelState {
+            vector<int32_t> tree;        // Fenwick tree of counts, indexed by count + 32768 + 1
+            vector<int16_t> ring;        // the last window readings
+            int64_t         filled = 0;
+            int64_t         oldest = 0;
+            int32_t         mad    = 0;          // MAD in counts at the last reading, where the next search starts
+        } ChannelState;
+        vector<ChannelState> st;
+        int64_t              flagged     = 0;
+
+        static const int32_t nbins = 65536;
+
+        static void tree_add(vector<int32_t>& t, const int16_t c, const int32_t v)
+        {
+            for (int32_t i = c + 32768 + 1; i <= nbins; i += i & -i)
+                t[i] += v;
+        }
+        static int32_t tree_prefix(const vector<int32_t>& t, int32_t i)  // readings with count + 32768 < i
+        {
+            int32_t s = 0;
+            for (; i > 0; i -= i & -i)
+                s += t[i];
+            return s;
+        }
+        static int32_t tree_kth(const vector<int32_t>& t, int32_t r)  // count of the r-th smallest reading, 1-based
+        {
+            int32_t pos = 0;
+            for (int32_t step = nbins; step > 0; step >>= 1)
+                if (pos + step <= nbins && t[pos + step] < r) {
+                    pos += step;
+                    r -= t[pos];
+                }
+            return pos - 32768;
+        }
+
+    public:
+
+        SpikeSink(HPFFile&, const vector<int32_t>& c, const int64_t w, const double kk, const bool r, ostream* l)
+            : chans(c), window(w), k(kk), replace(r), list(l), st(c.size())
+        {
+            if (window <= 0)
+                window = 101;
+            for (auto& s : st) {
+                s.tree.assign(nbins + 1, 0);
+                s.ring.assign(window, 0);
+            }
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            if (! follows(h, cnm, dsi, n)) {
+                for (auto& s : st) {
+                    std::fill(s.tree.begin(), s.tree.end(), 0);
+                    s.filled = s.oldest = 0;
+                }
+            }
+            stringstream ss;
+            if (list && ! header_done) {
+                ss << "Sample" << DEFAULT_SEP << "Time(s)" << DEFAULT_SEP << "Channel" << DEFAULT_SEP << "Value"
+                    << DEFAULT_SEP << "Median" << DEFAULT_SEP << "MAD" << endl;
+                header_done = true;
+            }
+            const int32_t half = (window + 1) / 2;
+            for (size_t c = 0; c < chans.size(); ++c) {
+                auto& ci = h.channelinfo[chans[c]];
+                auto& s = st[c];
+                auto& d = h.channeldata[chans[c]].data;
+                const int64_t m = d.size();
+                // dsi counts the first channel's readings; a channel with m readings a chunk to its n is at m / n
+                // the rate, so its own reading number for the chunk's first reading is dsi * m / n
+                const int64_t first = n > 0 ? dsi * m / n : dsi;
+                int64_t next = 0;  // next reading of this chunk to enter the window
+                for (int64_t i = 0; i < m; ++i) {
+                    // centre the window on reading i as far as this chunk reaches; original readings enter it,
+                    // before any replacement, and the oldest leaves
+                    for (const int64_t upto = std::min(i + window / 2, m - 1); next <= upto; ++next) {
+                        if (s.filled == window)
+                            tree_add(s.tree, s.ring[s.oldest], -1);
+                        else
+                            ++s.filled;
+                        tree_add(s.tree, d[next], 1);
+                        s.ring[s.oldest] = d[next];
+                        if (++s.oldest == window)
+                            s.oldest = 0;
+                    }
+                    const int16_t x = d[i];
+                    if (s.filled == window) {
+                        const int32_t med = tree_kth(s.tree, half);
+                        auto covers = [&s, med, half](const int32_t r) {  // at least half the readings within r of the median?
+                            int32_t a = std::max(med - r, -32768) + 32768, b = std::min(med + r, 32767) + 32768;
+                            return tree_prefix(s.tree, b + 1) - tree_prefix(s.tree, a) >= half;
+                        };
+                        // the MAD is the smallest r that covers; it moves little between readings, so gallop from the
+                        // last one to bracket it, then bisect the bracket
+                        int32_t lo, hi, step = 1;
+                        if (covers(s.mad)) {
+                            hi = s.mad;
+                            lo = hi - 1;
+                            while (lo >= 0 && covers(lo)) {
+                                hi = lo;
+                                step *= 2;
+                                lo = hi - step;
+                            }
+                            lo = std::max(lo + 1, 0);
+                        } else {
+                            lo = hi = s.mad + 1;
+                            while (! covers(hi)) {  // r = nbins always covers
+                                lo = hi + 1;
+                                step *= 2;
+                                hi = std::min(hi + step, int32_t(nbins));
+                            }
+                        }
+                        while (lo < hi) {
+                            int32_t mid = (lo + hi) / 2;
+                            if (covers(mid)) hi = mid;
+                            else             lo = mid + 1;
+                        }
+                        s.mad = lo;
+                        // 1.4826 MAD estimates the standard deviation; at least one count, so quantised flat signals are not all spikes
+                        if (std::abs(x - med) > k * 1.4826 * std::max(lo, 1)) {
+                            ++flagged;
+                            if (list) {
+                                int64_t sample = first + i;
+                                ss << sample << DEFAULT_SEP << setprecision(15) << sample * ci.TimeIncrement
+                                    << DEFAULT_SEP << ci.Name << DEFAULT_SEP << ci.interpret(x) << DEFAULT_SEP << ci.interpret(med)
+                                    << DEFAULT_SEP << std::abs(ci.interpret_at(med + lo) - ci.interpret(med)) << endl;
+                            }
+                            if (replace)
+                                d[i] = med;
+                        }
+                    }
+                }
+            }
+            if (list)
+                *list << ss.str();
+        }
+
+        void finish(HPFFile& h) override
+        {
+            if (h.debug)
+                cerr << cnm << ": " << flagged << " readings flagged" << endl;
+        }
+};
+
+
+
+class ShmRing
+{
+    ////
+    //// ShmRing is the layout of a POSIX shared memory ring of converted data blocks, written by ShmRingSink
+    //// and read by hpf ring or any other process mapping it.  A header, then slots of one block each: block
+    //// k of the recording goes in slot k % slots.  The single writer marks a slot's seq odd (2k + 1) while it
+    //// writes and even (2k + 2) when done, then advances published; a reader copies a slot and keeps the copy
+    //// only if seq read 2k + 2 both before and after, so it never waits on the writer and readers never
+    //// touch each other
+    ////
+
+    public:
+
+        static const char* magic() { return "HPFRING1"; }
+        static const size_t name_bytes = 64;  // per channel, NUL-terminated
+
+        typedef struct Header {
+            char                  magic[8];
+            uint32_t              header_bytes;   // offset of the first slot
+            uint32_t              slots;
+            uint64_t              slot_bytes;
+            uint32_t              block;          // readings per channel per slot, at most
+            int32_t               nchannels;
+            double                time_increment;
+            std::atomic<uint64_t> published;      // blocks written so far
+            std::atomic<uint32_t> closed;         // set once the writer has finished
+            std::atomic<uint32_t> ready;          // stored with release once the rest of the header and the names are written
+            // then nchannels names of name_bytes
+        } Header;
+
+        typedef struct Slot {
+            std::atomic<uint64_t> seq;
+            int64_t               datastartindex;
+            int32_t               n;
+            int32_t               pad;
+            // then double values[nchannels][block]
+        } Slot;
+
+        static size_t round64(const size_t n) { return (n + 63) & ~static_cast<size_t>(63); }
+        static string shm_name(const string& name) { return name.size() && name[0] == '/' ? name : "/" + name; }
+
+        char*   base = nullptr;
+        size_t  bytes = 0;
+        Header* hdr = nullptr;
+
+        const char* channel_name(const int32_t j) const { return base + sizeof(Header) + j * name_bytes; }
+        Slot*       slot(const uint64_t k) const { return reinterpret_cast<Slot*>(base + hdr->header_bytes + (k % hdr->slots) * hdr->slot_bytes); }
+        double*     values(Slot* s) const { return reinterpret_cast<double*>(reinterpret_cast<char*>(s) + sizeof(Slot)); }
+
+        ~ShmRing() { if (base) munmap(base, bytes); }
+};
+
+
+
+class ShmRingSink : public DataSink
+{
+    ////
+    //// ShmRingSink publishes each data chunk, converted, into a ShmRing as blocks of up to block readings,
+    //// for local consumers to pick up without a pipe or socket in between.  The segment is left in place
+    //// when the writer finishes, flagged closed, and replaced by the next writer of the same name
+    ////
+
+    public:
+
+        const string cnm = "ShmRingSink";
+
+        vector<int32_t> chans;
+        string          name;
+
+    private:
+
+        ShmRing  ring;
+        uint64_t next = 0;  // the next block to publish
+
+    public:
+
+        ShmRingSink(HPFFile& h, const vector<int32_t>& c, const string& nm, const int64_t slots, const int64_t block)
+            : chans(c), name(ShmRing::shm_name(nm))
+        {
+            if (slots < 2 || block < 1 || block > (1 << 24)) {
+                cerr << "*** --shm-slots must be at least 2 and --shm-block between 1 and " << (1 << 24) << endl;
+                exit(1);
+            }
+            size_t header_bytes = ShmRing::round64(sizeof(ShmRing::Header) + chans.size() * ShmRing::name_bytes);
+            size_t slot_bytes = ShmRing::round64(sizeof(ShmRing::Slot) + chans.size() * block * sizeof(double));
+            ring.bytes = header_bytes + slots * slot_bytes;
+            shm_unlink(name.c_str());  // a previous writer's ring, whose readers keep their mapping
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+            if (fd < 0 || ftruncate(fd, ring.bytes) < 0) {
+                cerr << "*** cannot create shared memory " << name << ": " << strerror(errno) << endl;
+                exit(1);
+            }
+            void* m = mmap(nullptr, ring.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (m == MAP_FAILED) {
+                cerr << "*** cannot map shared memory " << name << ": " << strerror(errno) << endl;
+                exit(1);
+            }
+            ring.base = static_cast<char*>(m);  // zero-filled by ftruncate
+            ring.hdr = new (ring.base) ShmRing::Header();
+            ring.hdr->header_bytes = header_bytes;
+            ring.hdr->slots = slots;
+            ring.hdr->slot_bytes = slot_bytes;
+            ring.hdr->block = block;
+            ring.hdr->nchannels = chans.size();
+            ring.hdr->time_increment = h.channelinfo[chans[0]].TimeIncrement;
+            for (size_t j = 0; j < chans.size(); ++j)
+                strncpy(const_cast<char*>(ring.channel_name(j)), h.channelinfo[chans[j]].Name.c_str(), ShmRing::name_bytes - 1);
+            for (int64_t k = 0; k < slots; ++k)
+                new (ring.slot(k)) ShmRing::Slot();
+            memcpy(ring.hdr->magic, ShmRing::magic(), sizeof(ring.hdr->magic));
+            ring.hdr->ready.store(1, std::memory_order_release);  // last, so a reader acquiring it sees a complete header
+            if (h.debug)
+                cerr << cnm << ": " << name << " " << ring.bytes << " bytes, " << slots << " slots of " << block << " readings" << endl;
+        }
+
+        void chunk(HPFFile& h, const int64_t dsi, const int32_t n) override
+        {
+            need_readings(h, chans, n, "use --channels to choose channels at one rate");
+            const int32_t block = ring.hdr->block;
+            for (int32_t i0 = 0; i0 < n; i0 += block) {
+                const int32_t m = std::min(block, n - i0);
+                auto s = ring.slot(next);
+                s->seq.store(2 * next + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                s->datastartindex = dsi + i0;
+                s->n = m;
+                double* v = ring.values(s);
+                for (size_t j = 0; j < chans.size(); ++j) {
+                    auto& ci = h.channelinfo[chans[j]];
+                    auto& x = h.channeldata[chans[j]].data;
+                    for (int32_t i = 0; i < m; ++i)
+                        v[j * block + i] = ci.interpret(x[i0 + i]);
+                }
+                s->seq.store(2 * next + 2, std::memory_order_release);
+                ring.hdr->published.store(++next, std::memory_order_release);
+            }
+        }
+
+        void finish(HPFFile& h) override
+        {
+            ring.hdr->closed.store(1, std::memory_order_release);
+            if (h.debug)
+                cerr << cnm << ": " << next << " blocks published to " << name << endl;
+        }
+};
+
+
+
+class SampleRange
+{
+    ////
+    //// SampleRange is a forward range over the readings [start, end) of some channels, in blocks that hide
+    //// data chunk boundaries: each Block has a span of counts and a span of converted values per channel,
+    //// contiguous so loops over them vectorise.  A background thread reads the chunks ahead through the
+    //// index with a private stream, converting them, up to depth chunks before the consumer, so iteration
+    //// waits on I/O only when the consumer outruns the disk.  The HPFFile must have read its info; a range
+    //// is iterated once
+    ////
+    ////     SampleRange r(h, h.channel_list("Ch0,Ch3"), 1000, 50000);
+    ////     for (auto& b : r)
+    ////         sum += std::accumulate(b.values[0].begin(), b.values[0].end(), 0.0);
+    ////
+
+    public:
+
+        const string cnm = "SampleRange";
+
+        typedef struct Block {
+            int64_t                        datastartindex;  // sample index of the first reading
+            int32_t                        n;               // readings per channel
+            vector<Span<const int16_t>>    counts;          // per channel of the range
+            vector<Span<const double>>     values;
+        } Block;
+
+        typedef struct Chunk {
+            HPFFile::RawChunk raw;
+            vector<double>  values;         // channel-major, n per channel
+            vector<size_t>  offset;         // of each channel's first count in raw, in int16s
+            int64_t         datastartindex;
+            int32_t         n;
+        } Chunk;
+
+        class iterator
+        {
+            public:
+                typedef std::input_iterator_tag iterator_category;
+                typedef Block                   value_type;
+                typedef std::ptrdiff_t          difference_type;
+                typedef const Block*            pointer;
+                typedef const Block&            reference;
+
+                iterator(SampleRange* r = nullptr) : range(r) { }
+                reference  operator*() const { return range->block; }
+                pointer    operator->() const { return &range->block; }
+                iterator&  operator++() { range->advance(); return *this; }
+                void       operator++(int) { range->advance(); }
+                bool       operator==(const iterator& o) const { return at_end() == o.at_end(); }
+                bool       operator!=(const iterator& o) const { return ! (*this == o); }
+
+            private:
+                SampleRange* range;
+                bool at_end() const { return ! range || range->finished; }
+        };
+
+        int64_t waits = 0;  // blocks the consumer had to wait for
+
+    private:
+
+        const HPFFile&         h;
+        const vector<int32_t>  chans;
+        const int64_t          from, to;
+        vector<size_t>         entries;     // index entries overlapping the range, by datastartindex
+        Block                  block;
+        bool                   started  = false;
+        bool                   finished = false;
+
+        std::mutex                          mutex;
+        std::condition_variable             cv;
+        std::deque<std::unique_ptr<Chunk>>  ready;
+        vector<std::unique_ptr<Chunk>>      spare;
+        std::unique_ptr<Chunk>              current;
+        bool                                done = false, stop = false;
+        std::thread                         reader;
+
+    public:
+
+        SampleRange(const HPFFile& hf, const vector<int32_t>& c, const int64_t s, const int64_t e, const int32_t depth = 4)
+            : h(hf), chans(c), from(s), to(e), entries(entries_in(hf, s, e))
+        {
+            for (auto i = 0; i < std::max(depth, 1) + 1; ++i)  // one more for the block being consumed
+                spare.emplace_back(new Chunk());
+        }
+
+        ~SampleRange()
+        {
+            if (reader.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stop = true;
+                }
+                cv.notify_all();
+                reader.join();
+            }
+        }
+
+        size_t chunks() const { return entries.size(); }
+
+        iterator begin()
+        {
+            if (! started) {
+                started = true;
+                reader = std::thread([this] { prefetch(); });
+                advance();
+            }
+            return iterator(this);
+        }
+        iterator end() const { return iterator(); }
+
+        static vector<size_t> entries_in(const HPFFile& h, const int64_t from, const int64_t to)
+        {   // the index entries of the active group's data chunks overlapping [from, to), by datastartindex
+            vector<size_t> v;
+            for (size_t i = 0; i < h.index.size(); ++i) {
+                auto& x = h.index[i];
+                if (x.chunkid == HPFFile::chunkid_data && x.groupid == h.groupid
+                    && x.datastartindex < to && x.datastartindex + x.perchanneldatalengthinsamples > from)
+                    v.push_back(i);
+            }
+            std::stable_sort(v.begin(), v.end(), [&h](size_t a, size_t b) {
+                return h.index[a].datastartindex < h.index[b].datastartindex;
+            });
+            return v;
+        }
+
+        static bool load(ifstream& f, const HPFFile& h, const size_t i, const vector<int32_t>& chans, const int64_t from,
+                         const int64_t to, Chunk& c)
+        {   // read index entry i's data chunk through f, keeping and converting the readings of chans in [from, to);
+            // false if it has none
+            static const string p = "SampleRange::load: ";
+            const size_t k = chans.size();
+            h.read_raw_chunk(f, i, c.raw, p);
+            const int64_t dsi = c.raw.datastartindex;
+            const int32_t n = h.raw_readings(c.raw, i, chans, p);
+            const int64_t lo = std::max<int64_t>(from - dsi, 0), hi = std::min<int64_t>(to - dsi, n);
+            if (lo >= hi)
+                return false;
+            const int32_t m = hi - lo;
+            c.datastartindex = dsi + lo;
+            c.n = m;
+            c.offset.resize(k);
+            c.values.resize(k * m);
+            for (size_t j = 0; j < k; ++j) {  // convert each column once
+                auto& ci = h.channelinfo[chans[j]];
+                c.offset[j] = c.raw.b[8 + 2*chans[j]] / 2 + lo;
+                const int16_t* d = reinterpret_cast<const int16_t*>(c.raw.b.data()) + c.offset[j];
+                double* o = &c.values[j * m];
+                if (ci.lut) {
+                    const double* t = &(*ci.lut)[32768];
+                    for (auto r = 0; r < m; ++r) o[r] = t[d[r]];
+                } else {
+                    const double sc = ci.out_scale, of = ci.out_offset;
+                    for (auto r = 0; r < m; ++r) o[r] = d[r] * sc + of;
+                }
+            }
+            return true;
+        }
+
+        static void fill(const Chunk& c, const size_t k, Block& b)
+        {   // point b's spans at chunk c, of k channels
+            b.datastartindex = c.datastartindex;
+            b.n = c.n;
+            b.counts.resize(k);
+            b.values.resize(k);
+            const int16_t* raw = reinterpret_cast<const int16_t*>(c.raw.b.data());
+            for (size_t j = 0; j < k; ++j) {
+                b.counts[j] = { raw + c.offset[j], static_cast<size_t>(c.n) };
+                b.values[j] = { &c.values[j * c.n], static_cast<size_t>(c.n) };
+            }
+        }
+
+    private:
+
+        void advance()
+        {   // hand the current chunk back to the reader and take the next one
+            std::unique_lock<std::mutex> lock(mutex);
+            if (current) {
+                spare.push_back(std::move(current));
+                cv.notify_all();
+            }
+            if (ready.empty() && ! done)
+                ++waits;
+            cv.wait(lock, [this] { return ! ready.empty() || done; });
+            if (ready.empty()) {
+                finished = true;
+                return;
+            }
+            current = std::move(ready.front());
+            ready.pop_front();
+            lock.unlock();
+            fill(*current, chans.size(), block);
+        }
+
+        void prefetch()
+        {   // load the chunks of entries[] in order into spare chunks, until stopped
+            ifstream f(h.file_name(), ios::in | ios::binary);
+            for (auto i : entries) {
+                std::unique_ptr<Chunk> c;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return stop || ! spare.empty(); });
+                    if (stop)
+                        return;
+                    c = std::move(spare.back());
+                    spare.pop_back();
+                }
+                bool some = load(f, h, i, chans, from, to, *c);
+                std::lock_guard<std::mutex> lock(mutex);
+                if (some)
+                    ready.push_back(std::move(c));
+                else
+                    spare.push_back(std::move(c));
+                cv.notify_all();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+            cv.notify_all();
+        }
+};
+
+
+#ifdef HPF_COROUTINES
+
+class WorkerPool
+{
+    ////
+    //// WorkerPool runs jobs on a fixed set of threads, first come first served
+    ////
+
+    private:
+
+        std::mutex                         mutex;
+        std::condition_variable            cv;
+        std::deque<std::function<void()>>  jobs;
+        vector<std::thread>                threads;
+        bool                               stop = false;
+
+    public:
+
+        WorkerPool(const unsigned n)
+        {
+            for (unsigned t = 0; t < std::max(n, 1u); ++t)
+                threads.emplace_back([this] { work(); });
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& t : threads)
+                t.join();
+        }
+
+        void submit(std::function<void()> f)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(f));
+            }
+            cv.notify_one();
+        }
+
+    private:
+
+        void work()
+        {
+            for (;;) {
+                std::function<void()> f;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return stop || ! jobs.empty(); });
+                    if (jobs.empty())
+                        return;
+                    f = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                f();
+            }
+        }
+};
+
+
+
+struct Task
+{   // a coroutine that starts at once and runs to completion with no result; the caller tracks its end
+    struct promise_type {
+        Task                get_return_object() { return { }; }
+        std::suspend_never  initial_suspend() noexcept { return { }; }
+        std::suspend_never  final_suspend() noexcept { return { }; }
+        void                return_void() { }
+        void                unhandled_exception() { std::terminate(); }
+    };
+};
+
+
+
+class AsyncReader
+{
+    ////
+    //// AsyncReader is SampleRange for coroutines.  co_await r.next_block() suspends the caller while a
+    //// WorkerPool thread reads and converts the next data chunk in [start, end), then resumes the caller on
+    //// that thread, true with block() filled in or false at the end of the range.  No thread waits on any
+    //// one recording, so a few threads serve many of them.  A block is valid until the next co_await
+    ////
+    ////     Task sum(AsyncReader& r, double& s) { while (co_await r.next_block()) for (auto v : r.block().values[0]) s += v; }
+    ////
+
+    public:
+
+        const string cnm = "AsyncReader";
+
+        typedef struct Awaiter {
+            AsyncReader& r;
+            bool await_ready() const noexcept
+            {   // at the end already, no need to suspend
+                if (r.next < r.entries.size())
+                    return false;
+                r.has_block = false;
+                return true;
+            }
+            void await_suspend(std::coroutine_handle<> c) { r.pool.submit([this, c] { r.load_next(); c.resume(); }); }
+            bool await_resume() const noexcept { return r.has_block; }
+        } Awaiter;
+
+    private:
+
+        const HPFFile&          h;
+        const vector<int32_t>   chans;
+        const int64_t           from, to;
+        WorkerPool&             pool;
+        vector<size_t>          entries;
+        size_t                  next = 0;
+        ifstream                f;
+        SampleRange::Chunk      chunk;
+        SampleRange::Block      blk;
+        bool                    has_block = false;
+
+    public:
+
+        AsyncReader(const HPFFile& hf, const vector<int32_t>& c, const int64_t s, const int64_t e, WorkerPool& p)
+            : h(hf), chans(c), from(s), to(e), pool(p), entries(SampleRange::entries_in(hf, s, e)),
+              f(hf.file_name(), ios::in | ios::binary)
+        { }
+
+        Awaiter                    next_block() { return { *this }; }
+        const SampleRange::Block&  block() const { return blk; }
+        const HPFFile&             file() const { return h; }
+        const vector<int32_t>&     channels() const { return chans; }
+
+    private:
+
+        void load_next()
+        {   // on a pool thread, with the coroutine suspended: load the next chunk holding readings in range
+            has_block = false;
+            while (next < entries.size())
+                if (SampleRange::load(f, h, entries[next++], chans, from, to, chunk)) {
+                    SampleRange::fill(chunk, chans.size(), blk);
+                    has_block = true;
+                    return;
+                }
+        }
+};
+
+#endif  // HPF_COROUTINES
+
+
+
+class HPFDiff
+{
+    ////
+    //// HPFDiff compares the readings of two HPF files channel by channel, aligned by sample index or by
+    //// StartTime.  Both indexes are walked in step, one data chunk of each in memory, comparing the samples
+    //// the two chunks share.  Spans whose counts are identical under identical conversions are settled with
+    //// memcmp; only other spans are converted and compared against the tolerance.  Reports differing
+    //// ranges and the largest absolute and relative errors, no data
+    ////
+
+    public:
+
+        const string cnm = "HPFDiff";
+        static const int64_t list_max = 100;  // differing ranges listed per channel, all are counted
+
+        HPFFile& a;
+        HPFFile& b;
+        double   tolerance;
+        int64_t  offset = 0;  // sample s of b is sample s + offset of a
+
+    private:
+
+        typedef struct Pair {
+            int32_t ca, cb;
+            bool    same_conversion;
+            int64_t compared = 0, differing = 0, ranges = 0;
+            double  max_abs = 0.0, max_rel = 0.0;
+            int64_t max_abs_at = -1, max_rel_at = -1;
+            int64_t range_start = -1, range_end = -1;
+            double  range_max = 0.0;
+        } Pair;
+        vector<Pair> pairs;
+        stringstream list;
+        int64_t      covered = 0;  // samples held by both files, whatever each pair made of them
+        int64_t      only_a = 0, only_b = 0;
+
+    public:
+
+        HPFDiff(HPFFile& ha, HPFFile& hb, const string& channels, const bool by_time, const double tol)
+            : a(ha), b(hb), tolerance(tol)
+        {
+            for (auto ca : a.channel_list(channels)) {
+                auto& name = a.channelinfo[ca].Name;
+                int32_t cb = -1;
+                for (auto& c : b.channelinfo)
+                    if (c.Name == name)
+                        cb = c._index;
+                if (cb < 0) {
+                    cerr << "*** channel " << name << " is not in " << b.file_name() << ", not compared" << endl;
+                    continue;
+                }
+                auto& ia = a.channelinfo[ca];
+                auto& ib = b.channelinfo[cb];
+                if (std::abs(ia.TimeIncrement - ib.TimeIncrement) > 1e-9 * std::abs(ia.TimeIncrement)) {
+                    cerr << "*** channel " << name << " is recorded at different rates, not compared" << endl;
+                    continue;
+                }
+                Pair p;
+                p.ca = ca;
+                p.cb = cb;
+                p.same_conversion = ! ia.lut && ! ib.lut && ia.out_scale == ib.out_scale && ia.out_offset == ib.out_offset;
+                pairs.push_back(p);
+            }
+            if (pairs.empty()) {
+                cerr << "*** no channels to compare" << endl;
+                exit(1);
+            }
+            if (by_time) {
+                auto seconds = [](const HPFFile::Time& t) {
+                    return HPFFile::TimeColumn::days_from_civil(t.y, t.m, t.d) * 86400.0 + t.h * 3600 + t.n * 60 + t.frac_s;
+                };
+                auto& ia = a.channelinfo[pairs[0].ca];
+                auto& ib = b.channelinfo[pairs[0].cb];
+                offset = llround((seconds(ib.StartTime) - seconds(ia.StartTime)) / ia.TimeIncrement);
+            }
+        }
+
+        bool run()
+        {   // returns true if every compared reading is within tolerance and both files cover the same samples
+            a.table = b.table = false;
+            size_t ia = next(a, 0), ib = next(b, 0);
+            bool la = load(a, ia), lb = load(b, ib);
+            while (la && lb) {
+                int64_t sa = a.last_datastartindex, ea = sa + rows(a);
+                int64_t sb = b.last_datastartindex + offset, eb = sb + rows(b);
+                int64_t s = std::max(sa, sb), e = std::min(ea, eb);
+                if (s < e)
+                    compare(s, e, sa, sb);
+                if (ea <= eb) la = load(a, ia = next(a, ia + 1));
+                if (eb <= ea) lb = load(b, ib = next(b, ib + 1));
+            }
+            for (auto& p : pairs)
+                close_range(p);
+            int64_t ta, tb, fa, fb;
+            ta = a.indexed_samples(fa, fa);
+            tb = b.indexed_samples(fb, fb);
+            only_a = ta - covered;
+            only_b = tb - covered;
+            report();
+            bool same = only_a == 0 && only_b == 0;
+            for (auto& p : pairs)
+                same = same && p.differing == 0;
+            return same;
+        }
+
+    private:
+
+        static size_t next(HPFFile& h, size_t i)
+        {   // the next data chunk of the active group in the index, at or after i
+            while (i < h.index.size() && (h.index[i].chunkid != HPFFile::chunkid_data || h.index[i].groupid != h.groupid))
+                ++i;
+            return i;
+        }
+
+        static bool load(HPFFile& h, const size_t i)
+        {
+            if (i >= h.index.size())
+                return false;
+            h.read_chunk_at(h.index[i].fileoffset);
+            return true;
+        }
+
+        int64_t rows(HPFFile& h) const
+        {
+            return h.channeldata[&h == &a ? pairs[0].ca : pairs[0].cb].data.size();
+        }
+
+        void compare(const int64_t s, const int64_t e, const int64_t sa, const int64_t sb)
+        {   // samples [s, e) in a's numbering, held from sa in a's chunk and from sb in b's
+            const int64_t m = e - s;
+            covered += m;
+            for (auto& p : pairs) {
+                auto& da = a.channeldata[p.ca].data;
+                auto& db = b.channeldata[p.cb].data;
+                if (static_cast<int64_t>(da.size()) < e - sa || static_cast<int64_t>(db.size()) < e - sb) {
+                    cerr << "*** channel " << a.channelinfo[p.ca].Name << " runs at a different rate from " << a.channelinfo[pairs[0].ca].Name
+                        << "; use --channels to compare channels at one rate" << endl;
+                    exit(1);
+                }
+                const int16_t* xa = &da[s - sa];
+                const int16_t* xb = &db[s - sb];
+                p.compared += m;
+                if (p.same_conversion && ! memcmp(xa, xb, m * sizeof(int16_t))) {
+                    close_range(p);
+                    continue;
+                }
+                auto& ca = a.channelinfo[p.ca];
+                auto& cb = b.channelinfo[p.cb];
+                for (int64_t i = 0; i < m; ++i) {
+                    double va = ca.interpret(xa[i]), vb = cb.interpret(xb[i]);
+                    double d = std::abs(va - vb);
+                    if (! (d <= tolerance) && ! (std::isnan(va) && std::isnan(vb))) {
+                        double mx = std::max(std::abs(va), std::abs(vb));
+                        double r = mx > 0.0 ? d / mx : 0.0;
+                        if (d > p.max_abs)      { p.max_abs = d; p.max_abs_at = s + i; }  // NaN against a number differs, but has no size
+                        if (r > p.max_rel)      { p.max_rel = r; p.max_rel_at = s + i; }
+                        ++p.differing;
+                        if (p.range_start >= 0 && p.range_end != s + i)
+                            close_range(p);
+                        if (p.range_start < 0) {
+                            p.range_start = s + i;
+                            p.range_max = std::numeric_limits<double>::quiet_NaN();  // stays NaN if only NaN differs
+                        }
+                        p.range_end = s + i + 1;
+                        if (d > p.range_max || (std::isnan(p.range_max) && ! std::isnan(d)))
+                            p.range_max = d;
+                    } else {
+                        close_range(p);
+                    }
+                }
+            }
+        }
+
+        void close_range(Pair& p)
+        {
+            if (p.range_start < 0)
+                return;
+            if (++p.ranges <= list_max)
+                list << a.channelinfo[p.ca].Name << DEFAULT_SEP << p.range_start << DEFAULT_SEP << p.range_end
+                    << DEFAULT_SEP << setprecision(15) << p.range_start * a.channelinfo[p.ca].TimeIncrement
+                    << DEFAULT_SEP << p.range_max << endl;
+            p.range_start = -1;
+        }
+
+        void report()
+        {
+            stringstream ss;
+            ss << "FileA :" << DEFAULT_SEP << a.file_name() << endl
+                << "FileB :" << DEFAULT_SEP << b.file_name() << endl
+                << "SampleOffset :" << DEFAULT_SEP << offset << endl
+                << "Tolerance :" << DEFAULT_SEP << tolerance << endl
+                << "OnlyInA :" << DEFAULT_SEP << only_a << endl
+                << "OnlyInB :" << DEFAULT_SEP << only_b << endl
+                << "" << DEFAULT_SEP << "" << endl;
+            ss << "Channel" << DEFAULT_SEP << "Compared" << DEFAULT_SEP << "Differing" << DEFAULT_SEP << "Ranges"
+                << DEFAULT_SEP << "MaxAbsError" << DEFAULT_SEP << "AtSample" << DEFAULT_SEP << "MaxRelError" << DEFAULT_SEP << "AtSample" << endl;
+            for (auto& p : pairs)
+                ss << a.channelinfo[p.ca].Name << DEFAULT_SEP << p.compared << DEFAULT_SEP << p.differing << DEFAULT_SEP << p.ranges
+                    << DEFAULT_SEP << setprecision(15) << p.max_abs << DEFAULT_SEP << p.max_abs_at
+                    << DEFAULT_SEP << p.max_rel << DEFAULT_SEP << p.max_rel_at << endl;
+            if (list.tellp() > 0) {
+                ss << "" << DEFAULT_SEP << "" << endl
+                    << "Channel" << DEFAULT_SEP << "StartSample" << DEFAULT_SEP << "EndSample" << DEFAULT_SEP << "StartTime(s)"
+                    << DEFAULT_SEP << "MaxAbsError" << endl
+                    << list.str();
+            }
+            cout << ss.str();
+        }
+};
+
+
+
+void usage(const char* prog);  // with the other command line code, before Options
+
+
+
+int
+diff_main(int argc, char* argv[])
+{   // hpf diff [options] a.hpf b.hpf
+    vector<string> files;
+    string channels, by = "sample", units = "volts";
+    double tolerance = 0.0;
+    bool sidecar = true;
+    unsigned char debug = 0;
+    for (auto i = 2; i < argc; ++i) {
+        string a(argv[i]);
+        if      (a == "--tolerance" && i + 1 < argc) tolerance = atof(argv[++i]);
+        else if (a == "--by" && i + 1 < argc)        by.assign(argv[++i]);
+        else if (a == "--channels" && i + 1 < argc)  channels.assign(argv[++i]);
+        else if (a == "--units" && i + 1 < argc)     units.assign(argv[++i]);
+        else if (a == "--no-sidecar")                sidecar = false;
+        else if (a == "--debug")                     ++debug;
+        else if (a == "--help" || a == "-h")         { usage(argv[0]); exit(0); }
+        else if (a.size() > 1 && a[0] == '-')        { cerr << "*** Unknown diff option " << a << endl; usage(argv[0]); exit(1); }
+        else                                         files.push_back(a);
+    }
+    if (files.size() != 2) {
+        cerr << "*** diff needs two files:  " << argv[0] << " diff a.hpf b.hpf" << endl;
+        usage(argv[0]);
+        exit(1);
+    }
+    if (by != "sample" && by != "time") {
+        cerr << "*** --by must be sample or time" << endl;
+        exit(1);
+    }
+    if (units != "volts" && units != "eng") {
+        cerr << "*** --units must be volts or eng" << endl;
+        exit(1);
+    }
+    HPFFile a(files[0]), b(files[1]);
+    for (auto h : { &a, &b }) {
+        h->debug = debug;
+        h->use_sidecar = sidecar;
+        h->eng_units = units == "eng";
+        if (! h->file_status() || ! h->read_info())
+            exit(1);
+    }
+    HPFDiff d(a, b, channels, by == "time", tolerance);
+    return d.run() ? 0 : 1;
+}
+
+
+
+class ChunkCache
+{
+    ////
+    //// ChunkCache holds decoded, converted data chunks, least recently used first out, within a budget of
+    //// bytes.  A chunk is keyed on its file and index entry
+    ////
+
+    public:
+
+        typedef struct Decoded {
+            int64_t                datastartindex;
+            vector<vector<double>> values;  // per channel
+        } Decoded;
+
+        size_t  budget;
+        size_t  bytes     = 0;
+        int64_t hits      = 0;
+        int64_t misses    = 0;
+        int64_t evictions = 0;
+
+    private:
+
+        typedef struct Entry {
+            uint64_t                       key;
+            std::shared_ptr<const Decoded> chunk;
+            size_t                         bytes;
+        } Entry;
+        std::list<Entry>                                          lru;  // most recently used first
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> map;
+
+    public:
+
+        ChunkCache(const size_t b) : budget(b) { }
+
+        static uint64_t key(const uint32_t file, const size_t entry) { return (static_cast<uint64_t>(file) << 40) | entry; }
+
+        std::shared_ptr<const Decoded> get(const uint64_t k)
+        {
+            auto it = map.find(k);
+            if (it == map.end()) {
+                ++misses;
+                return nullptr;
             }
-            ss << endl;
-            return ss.str();
+            ++hits;
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->chunk;
         }
-        string table_from_data_csv(const vector<ChannelDescriptor>& cd,
-                                   const string sep = DEFAULT_SEP)
-            // output all data in channeldata[] using channeldescriptor[]
+
+        void put(const uint64_t k, std::shared_ptr<const Decoded> c)
         {
-            if (table_data_lines == 0) { // this is the first data, so drop the header first
-                cout << table_header_csv(true);
+            size_t b = sizeof(Decoded);
+            for (auto& v : c->values)
+                b += sizeof(v) + v.size() * sizeof(double);
+            lru.push_front({ k, c, b });
+            map[k] = lru.begin();
+            bytes += b;
+            while (bytes > budget && lru.size() > 1) {  // always keep the newest chunk
+                bytes -= lru.back().bytes;
+                map.erase(lru.back().key);
+                lru.pop_back();
+                ++evictions;
             }
-            stringstream ss;
-            // fetch the number of items from the first channel descriptor
-            auto n = cd[0]._num_atoms;
+        }
 
-            for (auto i = 0; i < n; ++i) {
-                ++data_lines;  // the line of data in the table (all lines)
-                if (do_downsample && (data_lines - 1) % downsample_count) {
-                    // if we are downsampling, only output lines where (data_lines - 1) mod downsample_count == 0
-                    // so skip this line
-                    continue;
+        size_t size() const { return lru.size(); }
+};
+
+
+
+class HPFServer
+{
+    ////
+    //// HPFServer answers queries on a Unix domain socket, keeping each file it is asked about open with its
+    //// metadata and index read once, and recently decoded chunks in a ChunkCache.  Connections are served one
+    //// at a time, each carrying any number of requests, so a connection idle for idle_seconds is closed to let
+    //// the next in.  Every message is a uint32 length then that many bytes, at most message_max, native-endian,
+    //// strings being an int32 length then the bytes.  Requests start with "HPFQ" and an int32 op:
+    ////
+    ////   op_info    string file
+    ////              -> int32 status, int32 channels, per channel (string name, string unit), double
+    ////                 time increment, int64 first sample, int64 end sample
+    ////   op_range   string file, int64 start, int64 end, int32 step, int32 n, int32 channel[n] (n == 0: all)
+    ////              -> int32 status, int32 n, int64 rows, int64 sample[rows], double value[n][rows]
+    ////   op_stats   -> int32 status, int64 hits, misses, evictions, cached bytes, budget, cached chunks, int32 files
+    ////
+    //// A row is returned for each sample s in [start, end) that the file holds with (s - start) % step == 0.
+    //// A failed request gets status 1 and a string message, as does a range whose reply would pass
+    //// message_max; ask for it in pieces.  HPFFile exits on a corrupt chunk, and so then does the server, so
+    //// run it under something that restarts it
+    ////
+
+    public:
+
+        const string cnm = "HPFServer";
+        enum { op_info = 1, op_range = 2, op_stats = 3 };
+        static const uint32_t message_max = 1u << 30;
+
+        unsigned char debug        = 0;
+        int           idle_seconds = 30;  // 0 waits on a connection for ever
+        bool          use_sidecar = true;
+        bool          eng_units   = false;
+
+    private:
+
+        typedef struct OpenFile {
+            uint32_t                 id;
+            std::unique_ptr<HPFFile> h;
+            vector<size_t>           chunks;  // data chunks of the active group in the index, by datastartindex
+        } OpenFile;
+        std::map<string, OpenFile> files;
+        ChunkCache                 cache;
+
+    public:
+
+        HPFServer(const size_t budget) : cache(budget) { }
+
+        static bool read_all(const int fd, void* p, size_t n)
+        {
+            char* c = static_cast<char*>(p);
+            while (n) {
+                auto r = read(fd, c, n);
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0) return false;
+                c += r;
+                n -= r;
+            }
+            return true;
+        }
+        static bool write_all(const int fd, const void* p, size_t n)
+        {
+            const char* c = static_cast<const char*>(p);
+            while (n) {
+                auto r = write(fd, c, n);
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0) return false;
+                c += r;
+                n -= r;
+            }
+            return true;
+        }
+        static bool read_message(const int fd, string& m)
+        {
+            uint32_t n;
+            if (! read_all(fd, &n, sizeof(n)) || n > message_max)
+                return false;
+            m.resize(n);
+            return read_all(fd, &m[0], n);
+        }
+        static bool write_message(const int fd, const string& m)
+        {
+            if (m.size() > message_max)
+                return false;
+            uint32_t n = m.size();
+            return write_all(fd, &n, sizeof(n)) && write_all(fd, m.data(), n);
+        }
+
+        int serve(const string& path)
+        {
+            static const string p = cnm + ": ";
+            sockaddr_un addr;
+            if (path.size() >= sizeof(addr.sun_path)) { cerr << p << "*** socket path too long: " << path << endl; return 1; }
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) { cerr << p << "*** socket: " << strerror(errno) << endl; return 1; }
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            unlink(path.c_str());
+            if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+                cerr << p << "*** cannot listen on " << path << ": " << strerror(errno) << endl;
+                return 1;
+            }
+            signal(SIGPIPE, SIG_IGN);  // a client going away is seen as a failed write
+            if (debug)
+                cerr << p << "listening on " << path << ", cache budget " << cache.budget << " bytes" << endl;
+            for (;;) {
+                int c = accept(fd, nullptr, nullptr);
+                if (c < 0) {
+                    if (errno == EINTR) continue;
+                    cerr << p << "*** accept: " << strerror(errno) << endl;
+                    return 1;
                 }
-                table_data_lines++;  // the line of data in the table (all lines)
-                if (include_data_line)
-                    ss << (data_lines - 0) << sep;
-                for (auto j = 0; j < numberofchannels; ++j) {  // across each column/channel
-                    ss << setprecision(15) << channelinfo[j].interpret_as_volts(channeldata[j].data[i]);
-                    if (j < numberofchannels - 1)
-                        ss << sep;
+                if (idle_seconds > 0) {  // reads and writes then fail after idle_seconds without progress
+                    timeval tv = { idle_seconds, 0 };
+                    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
                 }
-                ss << endl;
+                string req;
+                while (read_message(c, req))
+                    if (! write_message(c, handle(req)))
+                        break;
+                close(c);
             }
-            return ss.str();
+        }
+
+        string handle(const string& req)
+        {
+            BinReader r(req.data(), req.size());
+            BinWriter w;
+            string why;
+            if (req.compare(0, 4, "HPFQ")) {
+                why = "not an HPFQ request";
+            } else {
+                r.ptr += 4;
+                auto op = r.get<int32_t>();
+                if (op == op_info)       why = info(r, w);
+                else if (op == op_range) why = range(r, w);
+                else if (op == op_stats) why = stats(w);
+                else                     why = "unknown op " + std::to_string(op);
+            }
+            if (why.empty())
+                return w.buf;
+            if (debug)
+                cerr << cnm << ": " << why << endl;
+            BinWriter e;
+            e.put(int32_t(1));
+            e.put_string(why);
+            return e.buf;
+        }
+
+    private:
+
+        OpenFile* open(const string& name, string& why)
+        {   // the file, opened and its metadata and index read on first use
+            char real[PATH_MAX];
+            if (! realpath(name.c_str(), real)) {
+                why = "cannot find " + name;
+                return nullptr;
+            }
+            auto it = files.find(real);
+            if (it != files.end())
+                return &it->second;
+            std::unique_ptr<HPFFile> h(new HPFFile(real));
+            h->debug = debug;
+            h->use_sidecar = use_sidecar;
+            h->eng_units = eng_units;
+            h->table = false;
+            if (! h->file_status() || ! h->read_info()) {
+                why = "cannot read " + name;
+                return nullptr;
+            }
+            OpenFile f;
+            f.id = files.size();
+            for (size_t i = 0; i < h->index.size(); ++i)
+                if (h->index[i].chunkid == HPFFile::chunkid_data && h->index[i].groupid == h->groupid)
+                    f.chunks.push_back(i);
+            std::stable_sort(f.chunks.begin(), f.chunks.end(), [&h](size_t x, size_t y) {
+                return h->index[x].datastartindex < h->index[y].datastartindex;
+            });
+            f.h = std::move(h);
+            return &(files[real] = std::move(f));
+        }
+
+        std::shared_ptr<const ChunkCache::Decoded> decoded(OpenFile& f, const size_t entry)
+        {
+            auto k = ChunkCache::key(f.id, entry);
+            auto c = cache.get(k);
+            if (c)
+                return c;
+            auto& h = *f.h;
+            h.read_chunk_at(h.index[entry].fileoffset);
+            auto d = std::make_shared<ChunkCache::Decoded>();
+            d->datastartindex = h.last_datastartindex;
+            d->values.resize(h.numberofchannels);
+            for (auto j = 0; j < h.numberofchannels; ++j) {
+                auto& ci = h.channelinfo[j];
+                auto& x = h.channeldata[j].data;
+                d->values[j].resize(x.size());
+                for (size_t i = 0; i < x.size(); ++i)
+                    d->values[j][i] = ci.interpret(x[i]);
+            }
+            cache.put(k, d);
+            return d;
+        }
+
+        string info(BinReader& r, BinWriter& w)
+        {
+            auto name = r.get_string();
+            if (! r.ok) return "bad info request";
+            string why;
+            auto f = open(name, why);
+            if (! f) return why;
+            auto& h = *f->h;
+            int64_t first, end;
+            h.indexed_samples(first, end);
+            w.put(int32_t(0));
+            w.put(h.numberofchannels);
+            for (auto& c : h.channelinfo) {
+                w.put_string(c.Name);
+                w.put_string(c.out_unit);
+            }
+            w.put(h.channelinfo[0].TimeIncrement);
+            w.put(first);
+            w.put(end);
+            return "";
+        }
+
+        string range(BinReader& r, BinWriter& w)
+        {
+            auto name = r.get_string();
+            auto start = r.get<int64_t>(), end = r.get<int64_t>();
+            auto step = r.get<int32_t>(), n = r.get<int32_t>();
+            if (! r.ok || step < 1 || n < 0 || n > 65536) return "bad range request";
+            vector<int32_t> chans(n);
+            for (auto& c : chans)
+                c = r.get<int32_t>();
+            if (! r.ok) return "bad range request";
+            string why;
+            auto f = open(name, why);
+            if (! f) return why;
+            auto& h = *f->h;
+            if (chans.empty())
+                for (auto j = 0; j < h.numberofchannels; ++j)
+                    chans.push_back(j);
+            for (auto c : chans)
+                if (c < 0 || c >= h.numberofchannels) return "no channel " + std::to_string(c);
+            // the first chunk that can hold start, by binary search on datastartindex
+            auto it = std::upper_bound(f->chunks.begin(), f->chunks.end(), start, [&h](int64_t s, size_t e) {
+                return s < h.index[e].datastartindex;
+            });
+            if (it != f->chunks.begin())
+                --it;
+            vector<int64_t> samples;
+            vector<vector<double>> values(chans.size());
+            const size_t row_bytes = sizeof(int64_t) + chans.size() * sizeof(double);
+            const size_t max_rows = (message_max - 2 * sizeof(int32_t) - sizeof(int64_t)) / row_bytes;
+            for (; it != f->chunks.end() && h.index[*it].datastartindex < end; ++it) {
+                auto d = decoded(*f, *it);
+                int64_t rows = d->values[chans[0]].size();
+                for (auto c : chans)
+                    if (static_cast<int64_t>(d->values[c].size()) != rows) return "channels run at different rates";
+                int64_t s = std::max(start, d->datastartindex), e = std::min(end, d->datastartindex + rows);
+                if (s < e && (s - start) % step)
+                    s += step - (s - start) % step;
+                for (; s < e; s += step) {
+                    if (samples.size() == max_rows)
+                        return "range too large, at most " + std::to_string(max_rows) + " rows of " + std::to_string(chans.size())
+                            + " channel(s) a request; ask for a shorter range or a larger step";
+                    samples.push_back(s);
+                    for (size_t j = 0; j < chans.size(); ++j)
+                        values[j].push_back(d->values[chans[j]][s - d->datastartindex]);
+                }
+            }
+            w.put(int32_t(0));
+            w.put(static_cast<int32_t>(chans.size()));
+            w.put(static_cast<int64_t>(samples.size()));
+            w.buf.append(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(int64_t));
+            for (auto& v : values)
+                w.buf.append(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(double));
+            return "";
+        }
+
+        string stats(BinWriter& w)
+        {
+            w.put(int32_t(0));
+            w.put(cache.hits);
+            w.put(cache.misses);
+            w.put(cache.evictions);
+            w.put(static_cast<int64_t>(cache.bytes));
+            w.put(static_cast<int64_t>(cache.budget));
+            w.put(static_cast<int64_t>(cache.size()));
+            w.put(static_cast<int32_t>(files.size()));
+            return "";
         }
 };
 
-std::ostream& operator<<(std::ostream& os, const HPFFile::Time& t)     { return os << t.out(); }
-std::ostream& operator<<(std::ostream& os, const HPFFile::DataType& t) { return os << t.out(); }
 
 
+int
+serve_main(int argc, char* argv[], const int first)
+{   // hpf serve [options] SOCKET, or hpfd [options] SOCKET
+    string sock, units = "volts";
+    double cache_mb = 256;
+    int idle = 30;
+    bool sidecar = true;
+    unsigned char debug = 0;
+    for (auto i = first; i < argc; ++i) {
+        string a(argv[i]);
+        if      (a == "--cache-mb" && i + 1 < argc) cache_mb = atof(argv[++i]);
+        else if (a == "--idle" && i + 1 < argc)     idle = atol(argv[++i]);
+        else if (a == "--units" && i + 1 < argc)    units.assign(argv[++i]);
+        else if (a == "--no-sidecar")               sidecar = false;
+        else if (a == "--debug")                    ++debug;
+        else if (a == "--help" || a == "-h")        { usage(argv[0]); exit(0); }
+        else if (a.size() > 1 && a[0] == '-')       { cerr << "*** Unknown serve option " << a << endl; usage(argv[0]); exit(1); }
+        else if (sock.empty())                      sock = a;
+        else { cerr << "*** Only one socket allowed, extra argument " << a << endl; usage(argv[0]); exit(1); }
+    }
+    if (sock.empty()) {
+        cerr << "*** serve needs a socket path" << endl;
+        usage(argv[0]);
+        exit(1);
+    }
+    if (units != "volts" && units != "eng") {
+        cerr << "*** --units must be volts or eng" << endl;
+        exit(1);
+    }
+    HPFServer server(static_cast<size_t>(std::max(cache_mb, 0.0) * 1024 * 1024));
+    server.debug = debug;
+    server.idle_seconds = std::max(idle, 0);
+    server.use_sidecar = sidecar;
+    server.eng_units = units == "eng";
+    return server.serve(sock);
+}
 
-int 
-main(int argc, char* argv[])
+int
+ask_main(int argc, char* argv[])
+{   // hpf ask SOCKET FILE [--start S] [--end E] [--step N] [--channels 0,1,...], or hpf ask SOCKET --stats
+    vector<string> args;
+    int64_t start = 0, end = std::numeric_limits<int64_t>::max();
+    int32_t step = 1;
+    string channels;
+    bool stats = false;
+    for (auto i = 2; i < argc; ++i) {
+        string a(argv[i]);
+        if      (a == "--start" && i + 1 < argc)    start = atoll(argv[++i]);
+        else if (a == "--end" && i + 1 < argc)      end = atoll(argv[++i]);
+        else if (a == "--step" && i + 1 < argc)     step = atol(argv[++i]);
+        else if (a == "--channels" && i + 1 < argc) channels.assign(argv[++i]);
+        else if (a == "--stats")                    stats = true;
+        else if (a.size() > 1 && a[0] == '-')       { cerr << "*** Unknown ask option " << a << endl; usage(argv[0]); exit(1); }
+        else                                        args.push_back(a);
+    }
+    if (args.size() != (stats ? 1u : 2u)) {
+        cerr << "*** ask needs a socket and a file, or a socket and --stats" << endl;
+        usage(argv[0]);
+        exit(1);
+    }
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, args[0].c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        cerr << "*** cannot connect to " << args[0] << ": " << strerror(errno) << endl;
+        exit(1);
+    }
+    auto call = [fd](const BinWriter& q) {
+        string m;
+        if (! HPFServer::write_message(fd, q.buf) || ! HPFServer::read_message(fd, m)) {
+            cerr << "*** no reply from server" << endl;
+            exit(1);
+        }
+        BinReader r(m.data(), m.size());
+        if (r.get<int32_t>() != 0) {
+            cerr << "*** " << r.get_string() << endl;
+            exit(1);
+        }
+        return m;
+    };
+    BinWriter q;
+    q.buf.append("HPFQ", 4);
+    if (stats) {
+        q.put(int32_t(HPFServer::op_stats));
+        auto m = call(q);
+        BinReader r(m.data(), m.size());
+        r.get<int32_t>();
+        int64_t hits = r.get<int64_t>(), misses = r.get<int64_t>();
+        cout << "Hits :" << DEFAULT_SEP << hits << endl
+            << "Misses :" << DEFAULT_SEP << misses << endl
+            << "HitRate :" << DEFAULT_SEP << (hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0) << endl
+            << "Evictions :" << DEFAULT_SEP << r.get<int64_t>() << endl
+            << "CachedBytes :" << DEFAULT_SEP << r.get<int64_t>() << endl
+            << "BudgetBytes :" << DEFAULT_SEP << r.get<int64_t>() << endl
+            << "CachedChunks :" << DEFAULT_SEP << r.get<int64_t>() << endl
+            << "FilesOpen :" << DEFAULT_SEP << r.get<int32_t>() << endl;
+        return 0;
+    }
+    q.put(int32_t(HPFServer::op_info));
+    q.put_string(args[1]);
+    auto m = call(q);
+    BinReader ri(m.data(), m.size());
+    ri.get<int32_t>();
+    vector<string> names(ri.get<int32_t>());
+    for (auto& n : names) {
+        n = ri.get_string();
+        ri.get_string();
+    }
+    vector<int32_t> chans;
+    stringstream cs(channels);
+    string c;
+    while (getline(cs, c, ','))
+        chans.push_back(atol(c.c_str()));
+    BinWriter qr;
+    qr.buf.append("HPFQ", 4);
+    qr.put(int32_t(HPFServer::op_range));
+    qr.put_string(args[1]);
+    qr.put(start);
+    qr.put(end);
+    qr.put(step);
+    qr.put(static_cast<int32_t>(chans.size()));
+    for (auto x : chans)
+        qr.put(x);
+    m = call(qr);
+    BinReader r(m.data(), m.size());
+    r.get<int32_t>();
+    auto n = r.get<int32_t>();
+    auto rows = r.get<int64_t>();
+    const int64_t* samples = reinterpret_cast<const int64_t*>(r.ptr);
+    const double* values = reinterpret_cast<const double*>(r.ptr + rows * sizeof(int64_t));
+    if (chans.empty())
+        for (auto j = 0; j < n; ++j)
+            chans.push_back(j);
+    stringstream ss;
+    ss << "Sample";
+    for (auto x : chans)
+        ss << DEFAULT_SEP << names[x];
+    ss << endl << setprecision(15);
+    for (int64_t i = 0; i < rows; ++i) {
+        ss << samples[i];
+        for (auto j = 0; j < n; ++j)
+            ss << DEFAULT_SEP << values[j * rows + i];
+        ss << endl;
+    }
+    cout << ss.str();
+    close(fd);
+    return 0;
+}
+
+
+
+int
+ring_main(int argc, char* argv[])
+{   // hpf ring NAME: print the blocks published to a shared memory ring as they arrive, until its writer finishes
+    string name;
+    bool from_start = false;
+    for (auto i = 2; i < argc; ++i) {
+        string a(argv[i]);
+        if      (a == "--from-start")             from_start = true;
+        else if (a.size() > 1 && a[0] == '-')     { cerr << "*** Unknown ring option " << a << endl; usage(argv[0]); exit(1); }
+        else if (name.empty())                    name = ShmRing::shm_name(a);
+        else { cerr << "*** Only one ring allowed, extra argument " << a << endl; usage(argv[0]); exit(1); }
+    }
+    if (name.empty()) {
+        cerr << "*** ring needs a shared memory name" << endl;
+        usage(argv[0]);
+        exit(1);
+    }
+    ShmRing ring;
+    int fd;
+    struct stat st;
+    for (int tries = 0; ; ++tries) {  // wait up to a few seconds for a writer to create the ring
+        fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd >= 0 && fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(ShmRing::Header))
+            break;
+        if (fd >= 0) close(fd);
+        if (tries == 500) { cerr << "*** no shared memory ring " << name << endl; exit(1); }
+        usleep(10000);
+    }
+    ring.bytes = st.st_size;
+    void* m = mmap(nullptr, ring.bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) { cerr << "*** cannot map shared memory " << name << ": " << strerror(errno) << endl; exit(1); }
+    ring.base = static_cast<char*>(m);
+    ring.hdr = reinterpret_cast<ShmRing::Header*>(ring.base);
+    for (int tries = 0; ! ring.hdr->ready.load(std::memory_order_acquire) && tries < 500; ++tries)  // the writer is still filling in the header
+        usleep(10000);
+    if (memcmp(ring.hdr->magic, ShmRing::magic(), sizeof(ring.hdr->magic))
+        || ring.hdr->header_bytes + ring.hdr->slots * ring.hdr->slot_bytes > ring.bytes) {
+        cerr << "*** " << name << " is not an hpf ring" << endl;
+        exit(1);
+    }
+    const int32_t nch = ring.hdr->nchannels, block = ring.hdr->block;
+    const uint64_t slots = ring.hdr->slots;
+    cout << "Sample";
+    for (auto j = 0; j < nch; ++j)
+        cout << DEFAULT_SEP << ring.channel_name(j);
+    cout << endl << setprecision(15);
+    vector<double> copy(static_cast<size_t>(nch) * block);
+    uint64_t k = 0, lost = 0;
+    if (! from_start) {
+        auto p = ring.hdr->published.load(std::memory_order_acquire);
+        k = p > slots ? p - slots : 0;
+    }
+    for (;;) {
+        const bool closed = ring.hdr->closed.load(std::memory_order_acquire);
+        const uint64_t published = ring.hdr->published.load(std::memory_order_acquire);
+        if (k >= published) {
+            if (closed) break;
+            cout.flush();
+            usleep(100);
+            continue;
+        }
+        if (published - k > slots) {  // lapped by the writer
+            lost += published - slots - k;
+            k = published - slots;
+        }
+        auto s = ring.slot(k);
+        const uint64_t s1 = s->seq.load(std::memory_order_acquire);
+        const int64_t dsi = s->datastartindex;
+        const int32_t n = s->n;
+        if (s1 == 2 * k + 2 && n >= 0 && n <= block)
+            memcpy(copy.data(), ring.values(s), copy.size() * sizeof(double));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s1 != 2 * k + 2 || s->seq.load(std::memory_order_relaxed) != s1 || n < 0 || n > block) {
+            ++lost;  // overwritten while we copied
+            ++k;
+            continue;
+        }
+        stringstream ss;
+        ss << setprecision(15);
+        for (int32_t i = 0; i < n; ++i) {
+            ss << dsi + i;
+            for (auto j = 0; j < nch; ++j)
+                ss << DEFAULT_SEP << copy[j * block + i];
+            ss << endl;
+        }
+        cout << ss.str();
+        ++k;
+    }
+    if (lost)
+        cerr << "*** " << lost << " blocks were overwritten before they could be read" << endl;
+    return lost ? 1 : 0;
+}
+
+
+
+#ifdef HPF_COROUTINES
+
+typedef struct Summary {
+    int64_t n = 0;
+    double  sum = 0.0;
+    double  min = std::numeric_limits<double>::infinity();
+    double  max = -std::numeric_limits<double>::infinity();
+} Summary;
+
+Task
+summarise(AsyncReader& r, vector<Summary>& out, std::latch& done)
+{   // count, sum and extremes of each channel of r's range, one chunk in memory at a time; NaN, a thermocouple
+    // reading beyond its table, is not counted
+    while (co_await r.next_block()) {
+        auto& b = r.block();
+        for (size_t j = 0; j < b.values.size(); ++j) {
+            auto& s = out[j];
+            double sum = 0.0, mn = s.min, mx = s.max;
+            int64_t n = 0;
+            for (auto v : b.values[j]) {
+                if (std::isnan(v))
+                    continue;
+                ++n;
+                sum += v;
+                mn = v < mn ? v : mn;
+                mx = v > mx ? v : mx;
+            }
+            s.n += n;
+            s.sum += sum;
+            s.min = mn;
+            s.max = mx;
+        }
+    }
+    done.count_down();
+}
+
+#endif  // HPF_COROUTINES
+
+int
+summary_main(int argc, char* argv[])
+{   // hpf summary [options] FILES...: per-channel readings, mean, min and max of each file, read concurrently
+#ifndef HPF_COROUTINES
+    for (auto i = 2; i < argc; ++i)  // the help is there in either build
+        if (! strcmp(argv[i], "--help") || ! strcmp(argv[i], "-h")) { usage(argv[0]); return 0; }
+    cerr << "*** summary needs C++20 coroutines; build with make STD=c++20" << endl;
+    return 1;
+#else
+    vector<string> files;
+    string channels, units = "volts";
+    unsigned threads = 0;
+    bool sidecar = true;
+    unsigned char debug = 0;
+    for (auto i = 2; i < argc; ++i) {
+        string a(argv[i]);
+        if      (a == "--threads" && i + 1 < argc)   threads = atol(argv[++i]);
+        else if (a == "--channels" && i + 1 < argc)  channels.assign(argv[++i]);
+        else if (a == "--units" && i + 1 < argc)     units.assign(argv[++i]);
+        else if (a == "--no-sidecar")                sidecar = false;
+        else if (a == "--debug")                     ++debug;
+        else if (a == "--help" || a == "-h")         { usage(argv[0]); exit(0); }
+        else if (a.size() > 1 && a[0] == '-')        { cerr << "*** Unknown summary option " << a << endl; usage(argv[0]); exit(1); }
+        else                                         files.push_back(a);
+    }
+    if (files.empty()) {
+        cerr << "*** summary needs at least one file" << endl;
+        usage(argv[0]);
+        exit(1);
+    }
+    if (units != "volts" && units != "eng") {
+        cerr << "*** --units must be volts or eng" << endl;
+        exit(1);
+    }
+    vector<std::unique_ptr<HPFFile>> hs;
+    for (auto& fn : files) {  // metadata first, on this thread
+        hs.emplace_back(new HPFFile(fn));
+        auto& h = *hs.back();
+        h.debug = debug;
+        h.use_sidecar = sidecar;
+        h.eng_units = units == "eng";
+        if (! h.file_status() || ! h.read_info())
+            exit(1);
+    }
+    vector<vector<Summary>> out(hs.size());
+    vector<std::unique_ptr<AsyncReader>> readers;
+    std::latch done(hs.size());
+    {
+        WorkerPool pool(threads ? threads : std::max(1u, std::thread::hardware_concurrency()));
+        for (size_t f = 0; f < hs.size(); ++f) {
+            auto chans = hs[f]->channel_list(channels);
+            out[f].resize(chans.size());
+            readers.emplace_back(new AsyncReader(*hs[f], chans, 0, std::numeric_limits<int64_t>::max(), pool));
+        }
+        for (size_t f = 0; f < hs.size(); ++f)
+            summarise(*readers[f], out[f], done);  // runs until its first co_await
+        done.wait();
+    }
+    cout << "File" << DEFAULT_SEP << "Channel" << DEFAULT_SEP << "Readings" << DEFAULT_SEP << "Mean" << DEFAULT_SEP
+        << "Min" << DEFAULT_SEP << "Max" << endl << setprecision(15);
+    for (size_t f = 0; f < hs.size(); ++f) {
+        auto& chans = readers[f]->channels();
+        for (size_t j = 0; j < chans.size(); ++j) {
+            auto& s = out[f][j];
+            cout << files[f] << DEFAULT_SEP << hs[f]->channelinfo[chans[j]].Name << DEFAULT_SEP << s.n << DEFAULT_SEP
+                << (s.n ? s.sum / s.n : 0.0) << DEFAULT_SEP << s.min << DEFAULT_SEP << s.max << endl;
+        }
+    }
+    return 0;
+#endif
+}
+
+
+
+void
+usage(const char* prog)
 {
+    cerr << endl
+        << "Usage:  " << prog << " [options] file.hpf" << endl
+        << "        " << prog << " diff [--tolerance V] [--by sample|time] [--channels CHS] [--units U] a.hpf b.hpf" << endl
+        << "        " << prog << " serve [--cache-mb N] [--idle S] [--units U] SOCKET   (also run as hpfd)" << endl
+        << "        " << prog << " ask SOCKET FILE [--start S] [--end E] [--step N] [--channels 0,1,...] | ask SOCKET --stats" << endl
+        << "        " << prog << " ring [--from-start] NAME" << endl
+        << "        " << prog << " summary [--threads N] [--channels CHS] [--units U] FILES...   (built with make STD=c++20)" << endl
+        << endl
+        << "  --info            print recording metadata only, read from header, channelinfo and index chunks" << endl
+        << "  --json            with --info, print the metadata as JSON" << endl
+        << "  --index           print the chunk index, read from the index chunk or rebuilt by scanning chunk headers" << endl
+        << "  --zonemap         with --info or --index, also compute per-chunk channel min/max for the sidecar" << endl
+        << "  --above CH V      print the periods where channel CH (name or number) is above V, skipping chunks by zone map" << endl
+        << "  --below CH V      print the periods where channel CH is below V" << endl
+        << "  --downsample N    output every N-th reading, default 1000; 1 outputs every reading" << endl
+        << "  --units U         output values in volts (the default) or eng, sensor units and thermocouple temperatures" << endl
+        << "  --group G         for files with several channel groups, use group G rather than the first" << endl
+        << "  --split PREFIX    write the table of each channel group G to PREFIXgroupG.txt" << endl
+        << "  --time T          add a Time column to the table, T is absolute, relative (seconds) or epoch (seconds)" << endl
+        << "  --align M         for channels at different rates, resample onto one time base, M is zoh or linear" << endl
+        << "  --rate R          with --align, output rate in Hz, default the fastest channel's" << endl
+        << "  --derive DEF      add a table column computed from other channels, e.g. 'P = Ch0 * Ch1'; may be repeated" << endl
+        << "  --where EXPR      output only rows matching EXPR, e.g. 'Ch3 > 2.5 && (Ch4 < 0 || !(Ch5 >= 1))'" << endl
+        << "  --trigger CH V    output windows around crossings of V volts on channel CH instead of the table" << endl
+        << "  --edge E          with --trigger, rising, falling or both, default rising" << endl
+        << "  --hysteresis H    with --trigger, re-arm only after moving H volts back across V, default 0" << endl
+        << "  --pre N           with --trigger, readings before each crossing to output, default 100" << endl
+        << "  --post N          with --trigger, readings after each crossing to output, default 100" << endl
+        << "  --events FILE     with --trigger, write the list of crossings to FILE" << endl
+        << "  --psd CHANNELS    output the Welch power spectral density of CHANNELS (comma-separated, or all) instead of the table" << endl
+        << "  --nfft N          with --psd, segment length, a power of two, default 1024" << endl
+        << "  --overlap N       with --psd, readings shared by successive segments, default nfft/2" << endl
+        << "  --block N         with --psd or --corr, output for each N readings rather than once overall" << endl
+        << "  --tones FREQS     output amplitude and phase at FREQS Hz (comma-separated) per window, instead of the table" << endl
+        << "  --window N        with --tones or --rolling, readings per window, default one second" << endl
+        << "  --channels CHS    channels (comma-separated names or numbers) used by --tones, --lttb and --rolling, default all" << endl
+        << "  --qc              report gaps, clipping, flat runs and steps instead of the table" << endl
+        << "  --flat N          with --qc, report runs of more than N identical readings, default 1000" << endl
+        << "  --step V          with --qc, report changes of at least V between successive readings, in the output" << endl
+        << "                    units: volts, or with --units eng sensor units and thermocouple temperatures" << endl
+        << "  --compress M      write long-format points only on significant change, M is deadband or swingingdoor" << endl
+        << "  --tolerance TOLS  with --compress, a tolerance for all channels, or per channel as CH=V,CH=V, in the output" << endl
+        << "                    units: volts, or with --units eng sensor units and thermocouple temperatures" << endl
+        << "  --lttb N          write about N visually representative points per channel in --channels, long format" << endl
+        << "  --rolling STATS   write moving mean,rms,std (any of them) of --channels over --window readings" << endl
+        << "  --hop N           with --rolling, readings between rows, default the window" << endl
+        << "  --samples S:E     print readings S up to E (or the end) of --channels, reading ahead through the index" << endl
+        << "  --corr CHANNELS   print the correlation and covariance matrices of CHANNELS (comma-separated, or all)" << endl
+        << "  --spikes CHANNELS list readings of CHANNELS (comma-separated, or all) far from their recent median, instead of the table" << endl
+        << "  --despike CHANNELS replace such readings with the median before any other output, listing them to --events FILE" << endl
+        << "  --spike-window N  with --spikes or --despike, readings in the median window, default 101" << endl
+        << "  --spike-k K       with --spikes or --despike, flag readings more than K scaled MADs from the median, default 3" << endl
+        << "  --shm NAME        publish the readings of --channels to the POSIX shared memory ring NAME instead of the table" << endl
+        << "  --shm-slots N     with --shm, blocks held in the ring, default 64" << endl
+        << "  --shm-block N     with --shm, readings per channel in a block, default 4096" << endl
+        << "  --no-sidecar      do not read or write the .hpfidx sidecar used by --info and --index" << endl
+        << "  --threads N       threads for scanning chunk headers, default one per hardware thread for files over 64MB" << endl
+        << "  --read-ahead N    keep N reads of 1MB in flight ahead of chunks decoded in file order, through io_uring if built in" << endl
+        << "                    (reads through the index, for --where, --above, --lttb, diff and serve, stay direct)" << endl
+        << "  --debug           print lots of info to cerr, repeat for more" << endl
+        << "  --help            this help" << endl
+        << endl;
+}
+
+
+
+typedef struct Options {
+    ////
+    //// Options of the main hpf command line, read by parse_options() and used by the *_mode() functions
+    ////
     string file;
-    if (argc > 1)
-        file.assign(argv[1]);
-    else
-        cerr << "*** Must provide filename as only argument:  " << argv[0] << " file.hpf" << endl;
-    HPFFile h(file);
-    if (! h.file_status())
+    bool info = false, json = false, dump_index = false, sidecar = true, zonemap = false;
+    string query_ch, query_op, where;
+    double query_v = 0.0;
+    int64_t downsample = -1;
+    string trigger_ch, edge = "rising", events_file;
+    double trigger_v = 0.0, hysteresis = 0.0;
+    int64_t pre = 100, post = 100;
+    bool psd = false;
+    string psd_chans;
+    int64_t nfft = 1024, overlap = -1, block = 0;
+    string tones, channels;
+    int64_t window = 0;
+    bool qc = false;
+    int64_t flat = 1000;
+    double step = 0.0;
+    string compress, tolerance = "0";
+    int64_t lttb = 0;
+    string time_mode, align;
+    double rate = 0.0;
+    unsigned char debug = 0;
+    unsigned threads = 0, read_ahead = 0;
+    int64_t group = -1;
+    string split, units = "volts";
+    vector<string> derives;
+    string rolling, corr, spikes, despike, shm, samples;
+    int64_t shm_slots = 64, shm_block = 4096;
+    int64_t spike_window = 101;
+    double spike_k = 3.0;
+    int64_t hop = 0;
+    bool sink_mode() const  // modes that stream the data through sinks instead of printing the table
+    {
+        return ! trigger_ch.empty() || psd || ! tones.empty() || qc || ! compress.empty() || ! align.empty() || ! rolling.empty()
+               || ! spikes.empty() || ! shm.empty();
+    }
+} Options;
+
+
+
+void
+parse_options(int argc, char* argv[], Options& o)
+{
+    for (auto i = 1; i < argc; ++i) {
+        string a(argv[i]);
+        if      (a == "--info")   o.info = true;
+        else if (a == "--json")   o.json = true;
+        else if (a == "--index")  o.dump_index = true;
+        else if (a == "--no-sidecar") o.sidecar = false;
+        else if (a == "--zonemap") o.zonemap = true;
+        else if (a == "--downsample" && i + 1 < argc) o.downsample = atol(argv[++i]);
+        else if (a == "--where" && i + 1 < argc) o.where.assign(argv[++i]);
+        else if (a == "--trigger" && i + 2 < argc) {
+            o.trigger_ch.assign(argv[++i]);
+            o.trigger_v = atof(argv[++i]);
+        }
+        else if (a == "--edge" && i + 1 < argc)       o.edge.assign(argv[++i]);
+        else if (a == "--hysteresis" && i + 1 < argc) o.hysteresis = atof(argv[++i]);
+        else if (a == "--pre" && i + 1 < argc)        o.pre = atol(argv[++i]);
+        else if (a == "--post" && i + 1 < argc)       o.post = atol(argv[++i]);
+        else if (a == "--events" && i + 1 < argc)     o.events_file.assign(argv[++i]);
+        else if (a == "--psd" && i + 1 < argc)        { o.psd = true; o.psd_chans.assign(argv[++i]); }
+        else if (a == "--nfft" && i + 1 < argc)       o.nfft = atol(argv[++i]);
+        else if (a == "--overlap" && i + 1 < argc)    o.overlap = atol(argv[++i]);
+        else if (a == "--block" && i + 1 < argc)      o.block = atol(argv[++i]);
+        else if (a == "--tones" && i + 1 < argc)      o.tones.assign(argv[++i]);
+        else if (a == "--window" && i + 1 < argc)     o.window = atol(argv[++i]);
+        else if (a == "--channels" && i + 1 < argc)   o.channels.assign(argv[++i]);
+        else if (a == "--qc")                         o.qc = true;
+        else if (a == "--flat" && i + 1 < argc)       o.flat = atol(argv[++i]);
+        else if (a == "--step" && i + 1 < argc)       o.step = atof(argv[++i]);
+        else if (a == "--compress" && i + 1 < argc)   o.compress.assign(argv[++i]);
+        else if (a == "--tolerance" && i + 1 < argc)  o.tolerance.assign(argv[++i]);
+        else if (a == "--lttb" && i + 1 < argc)       o.lttb = atol(argv[++i]);
+        else if (a == "--time" && i + 1 < argc)       o.time_mode.assign(argv[++i]);
+        else if (a == "--align" && i + 1 < argc)      o.align.assign(argv[++i]);
+        else if (a == "--rate" && i + 1 < argc)       o.rate = atof(argv[++i]);
+        else if (a == "--spikes" && i + 1 < argc)     o.spikes.assign(argv[++i]);
+        else if (a == "--despike" && i + 1 < argc)    o.despike.assign(argv[++i]);
+        else if (a == "--spike-window" && i + 1 < argc) o.spike_window = atol(argv[++i]);
+        else if (a == "--spike-k" && i + 1 < argc)    o.spike_k = atof(argv[++i]);
+        else if (a == "--shm" && i + 1 < argc)        o.shm.assign(argv[++i]);
+        else if (a == "--shm-slots" && i + 1 < argc)  o.shm_slots = atol(argv[++i]);
+        else if (a == "--shm-block" && i + 1 < argc)  o.shm_block = atol(argv[++i]);
+        else if (a == "--corr" && i + 1 < argc)       o.corr.assign(argv[++i]);
+        else if (a == "--samples" && i + 1 < argc)    o.samples.assign(argv[++i]);
+        else if (a == "--rolling" && i + 1 < argc)    o.rolling.assign(argv[++i]);
+        else if (a == "--hop" && i + 1 < argc)        o.hop = atol(argv[++i]);
+        else if (a == "--derive" && i + 1 < argc)     o.derives.push_back(argv[++i]);
+        else if (a == "--units" && i + 1 < argc)      o.units.assign(argv[++i]);
+        else if (a == "--group" && i + 1 < argc)      o.group = atol(argv[++i]);
+        else if (a == "--split" && i + 1 < argc)      o.split.assign(argv[++i]);
+        else if ((a == "--above" || a == "--below") && i + 2 < argc) {
+            o.query_op = (a == "--above") ? ">" : "<";
+            o.query_ch.assign(argv[++i]);
+            o.query_v = atof(argv[++i]);
+        }
+        else if (a == "--threads" && i + 1 < argc) o.threads = atol(argv[++i]);
+        else if (a == "--read-ahead" && i + 1 < argc) o.read_ahead = atol(argv[++i]);
+        else if (a == "--debug")  ++o.debug;
+        else if (a == "--help" || a == "-h") { usage(argv[0]); exit(0); }
+        else if (a.size() > 1 && a[0] == '-') { cerr << "*** Unknown option " << a << endl; usage(argv[0]); exit(1); }
+        else if (o.file.empty())  o.file.assign(a);
+        else { cerr << "*** Only one filename allowed, extra argument " << a << endl; usage(argv[0]); exit(1); }
+    }
+    if (o.file.empty()) {
+        cerr << "*** Must provide filename:  " << argv[0] << " file.hpf" << endl;
+        usage(argv[0]);
+        exit(1);
+    }
+    if (o.units != "volts" && o.units != "eng") {
+        cerr << "*** --units must be volts or eng" << endl;
+        exit(1);
+    }
+    const bool sink_mode = o.sink_mode();
+    if (! o.split.empty() && (! o.query_op.empty() || o.info || o.dump_index || ! o.where.empty() || o.lttb > 0 || ! o.corr.empty()
+                              || ! o.samples.empty() || sink_mode || ! o.despike.empty())) {
+        cerr << "*** --split applies only to the table" << endl;
+        exit(1);
+    }
+    if (! o.derives.empty() && (! o.split.empty() || ! o.query_op.empty() || o.info || o.dump_index || o.lttb > 0 || ! o.corr.empty()
+                                || ! o.samples.empty() || sink_mode)) {
+        cerr << "*** --derive applies only to the table of one group" << endl;
+        exit(1);
+    }
+    if (! o.despike.empty() && (! o.query_op.empty() || o.info || o.dump_index || ! o.corr.empty() || ! o.samples.empty())) {
+        cerr << "*** --despike applies to the table and to the modes replacing it" << endl;
+        exit(1);
+    }
+    if (! o.despike.empty() && ! o.trigger_ch.empty() && ! o.events_file.empty()) {
+        cerr << "*** --events lists either --trigger crossings or --despike spikes, not both" << endl;
+        exit(1);
+    }
+}
+
+
+
+void
+compile_derives(HPFFile& h, const Options& o)
+{   // definitions may also be separated by ';'
+    for (auto& d : o.derives) {
+        stringstream ss(d);
+        string x;
+        while (getline(ss, x, ';'))
+            if (x.find_first_not_of(" \t") != string::npos)
+                h.compile_derive(x);
+    }
+}
+
+
+
+typedef struct Despiker {
+    ////
+    //// Despiker holds the --despike pre-sink and its events file for as long as a mode reads the data
+    ////
+    std::unique_ptr<SpikeSink> sink;
+    ofstream                   events;
+    void add(HPFFile& h, const Options& o)  // once channelinfo is known
+    {
+        if (o.despike.empty())
+            return;
+        if (! o.events_file.empty()) {
+            events.open(o.events_file);
+            if (! events) { cerr << "*** Cannot open " << o.events_file << endl; exit(1); }
+        }
+        sink.reset(new SpikeSink(h, h.channel_list(o.despike), o.spike_window, o.spike_k, true, o.events_file.empty() ? nullptr : &events));
+        h.pre_sinks.push_back(sink.get());
+    }
+} Despiker;
+
+
+
+int
+query_mode(HPFFile& h, const Options& o)
+{   // --above, --below
+    if (! h.read_info())
+        exit(1);
+    auto ch = h.channel_number(o.query_ch);
+    h.query_periods(ch, h.count_range(ch, o.query_op, o.query_v));
+    return 0;
+}
+
+
+
+int
+info_mode(HPFFile& h, const Options& o)
+{   // --info, --index
+    if (! h.read_info())
+        exit(1);
+    if (o.zonemap && h.zonemap.size() != h.index.size() * h.numberofchannels) {
+        h.build_zonemap();
+        if (o.sidecar)
+            h.write_sidecar();
+    }
+    if (o.info)
+        cout << (o.json ? h.info_json() : h.info_text());
+    if (o.dump_index)
+        cout << h.index_text();
+    return 0;
+}
+
+
+
+int
+where_mode(HPFFile& h, const Options& o)
+{   // --where
+    if (! h.read_info())
+        exit(1);
+    compile_derives(h, o);
+    Despiker despiker;
+    despiker.add(h, o);
+    h.compile_filter(o.where);
+    h.read_indexed();
+    return 0;
+}
+
+
+
+int
+lttb_mode(HPFFile& h, const Options& o)
+{   // --lttb; buckets are fixed from the total in the index, so the data chunks are read through it
+    if (! h.read_info())
+        exit(1);
+    int64_t first, end;
+    Despiker despiker;
+    despiker.add(h, o);
+    LttbSink sink(h, h.channel_list(o.channels), o.lttb, h.indexed_samples(first, end));
+    h.table = false;
+    h.sinks.push_back(&sink);
+    h.read_indexed();
+    h.finish_sinks();
+    return 0;
+}
+
+
+
+int
+samples_mode(HPFFile& h, const Options& o)
+{   // --samples; a SampleRange reads the chunks holding the readings ahead of the output, through the index
+    if (! h.read_info())
+        exit(1);
+    auto colon = o.samples.find(':');
+    int64_t s = atoll(o.samples.substr(0, colon).c_str());
+    int64_t e = (colon == string::npos || colon + 1 == o.samples.size()) ? std::numeric_limits<int64_t>::max()
+              : atoll(o.samples.substr(colon + 1).c_str());
+    auto chans = h.channel_list(o.channels);
+    SampleRange r(h, chans, s, e);
+    cout << "Sample";
+    for (auto c : chans)
+        cout << DEFAULT_SEP << h.channelinfo[c].Name;
+    cout << endl;
+    for (auto& b : r) {
+        stringstream ss;
+        ss << setprecision(15);
+        for (int32_t i = 0; i < b.n; ++i) {
+            ss << b.datastartindex + i;
+            for (auto& v : b.values)
+                ss << DEFAULT_SEP << v[i];
+            ss << endl;
+        }
+        cout << ss.str();
+    }
+    if (h.debug)
+        cerr << r.cnm << ": " << r.chunks() << " chunks read, waited for " << r.waits << endl;
+    return 0;
+}
+
+
+
+int
+corr_mode(HPFFile& h, const Options& o)
+{   // --corr; reads the data chunks through the index, split across --threads
+    if (! h.read_info())
+        exit(1);
+    h.correlation(h.channel_list(o.corr), std::max<int64_t>(o.block, 0));
+    return 0;
+}
+
+
+
+int
+sink_mode(HPFFile& h, const Options& o)
+{   // --trigger, --psd, --tones, --qc, --compress, --align, --rolling, --spikes and --shm
+    // sinks need channelinfo, so read the leading chunks and create them before the data arrives
+    if (! h.read_leading())
         exit(1);
+    Despiker despiker;
+    despiker.add(h, o);
+    vector<std::unique_ptr<DataSink>> sinks;
+    ofstream ev;
+    if (! o.trigger_ch.empty()) {
+        int e = (o.edge == "rising") ? TriggerSink::rising : (o.edge == "falling") ? TriggerSink::falling
+              : (o.edge == "both") ? TriggerSink::both : 0;
+        if (! e) { cerr << "*** --edge must be rising, falling or both" << endl; exit(1); }
+        if (! o.events_file.empty()) {
+            ev.open(o.events_file);
+            if (! ev) { cerr << "*** Cannot open " << o.events_file << endl; exit(1); }
+        }
+        sinks.emplace_back(new TriggerSink(h, h.channel_number(o.trigger_ch), o.trigger_v, o.hysteresis, e, std::max<int64_t>(o.pre, 0),
+                                           std::max<int64_t>(o.post, 0), o.events_file.empty() ? nullptr : &ev));
+    }
+    if (o.psd) {
+        if (o.nfft < 2) { cerr << "*** --nfft must be at least 2" << endl; exit(1); }
+        sinks.emplace_back(new PsdSink(h, h.channel_list(o.psd_chans), o.nfft, o.overlap < 0 ? o.nfft / 2 : o.overlap, o.block));
+    }
+    if (! o.tones.empty()) {
+        vector<double> f;
+        stringstream ss(o.tones);
+        string x;
+        while (getline(ss, x, ','))
+            f.push_back(atof(x.c_str()));
+        sinks.emplace_back(new ToneSink(h, h.channel_list(o.channels), f, o.window));
+    }
+    if (o.qc)
+        sinks.emplace_back(new QcSink(h, o.flat, o.step));
+    if (! o.compress.empty()) {
+        int m = (o.compress == "deadband") ? CompressSink::deadband : (o.compress == "swingingdoor") ? CompressSink::swingingdoor : -1;
+        if (m < 0) { cerr << "*** --compress must be deadband or swingingdoor" << endl; exit(1); }
+        vector<double> tol(h.numberofchannels, 0.0);
+        stringstream ss(o.tolerance);
+        string x;
+        while (getline(ss, x, ',')) {
+            auto eq = x.find('=');
+            if (eq == string::npos)
+                std::fill(tol.begin(), tol.end(), atof(x.c_str()));
+            else
+                tol[h.channel_number(x.substr(0, eq))] = atof(x.substr(eq + 1).c_str());
+        }
+        sinks.emplace_back(new CompressSink(h, m, tol));
+    }
+    if (! o.align.empty()) {
+        int m = (o.align == "zoh") ? AlignSink::zoh : (o.align == "linear") ? AlignSink::linear : -1;
+        if (m < 0) { cerr << "*** --align must be zoh or linear" << endl; exit(1); }
+        sinks.emplace_back(new AlignSink(h, m, o.rate));
+    }
+    if (! o.rolling.empty())
+        sinks.emplace_back(new RollingSink(h, h.channel_list(o.channels), o.rolling, o.window, o.hop));
+    if (! o.spikes.empty())
+        sinks.emplace_back(new SpikeSink(h, h.channel_list(o.spikes), o.spike_window, o.spike_k, false, &cout));
+    if (! o.shm.empty())
+        sinks.emplace_back(new ShmRingSink(h, h.channel_list(o.channels), o.shm, o.shm_slots, o.shm_block));
+    h.table = false;
+    for (auto& sink : sinks)
+        h.sinks.push_back(sink.get());
+    while (h.read_chunk());
+    h.finish_sinks();
+    return 0;
+}
+
+
+
+int
+table_mode(HPFFile& h, const Options& o)
+{   // the table, when no other mode is chosen
+    Despiker despiker;
+    if (! o.derives.empty() || ! o.despike.empty()) {
+        if (! h.read_leading())
+            exit(1);
+        compile_derives(h, o);
+        despiker.add(h, o);
+    }
     while (h.read_chunk());
-  
+    h.finish_sinks();
+
     if (0) {  // for debugging; dump the first several chunks
         h.read_chunk();
         h.read_chunk();
@@ -1105,6 +6646,63 @@ main(int argc, char* argv[])
     // h.summarise_data();
     //cout << "," << endl;
     //cout << "," << endl;
+    return 0;
 }
 
 
+
+int
+main(int argc, char* argv[])
+{
+    if (argc > 1 && string(argv[1]) == "diff")
+        return diff_main(argc, argv);
+    string prog(argv[0]);
+    if (prog.size() >= 4 && prog.compare(prog.size() - 4, 4, "hpfd") == 0)
+        return serve_main(argc, argv, 1);
+    if (argc > 1 && string(argv[1]) == "serve")
+        return serve_main(argc, argv, 2);
+    if (argc > 1 && string(argv[1]) == "ask")
+        return ask_main(argc, argv);
+    if (argc > 1 && string(argv[1]) == "ring")
+        return ring_main(argc, argv);
+    if (argc > 1 && string(argv[1]) == "summary")
+        return summary_main(argc, argv);
+    Options o;
+    parse_options(argc, argv, o);
+    HPFFile h(o.file);
+    h.debug = o.debug;
+    h.scan_threads = o.threads;
+    h.read_ahead = o.read_ahead;
+    h.use_sidecar = o.sidecar;
+    h.only_group = o.group;
+    h.eng_units = o.units == "eng";
+    h.split_prefix = o.split;
+    if (! h.file_status())
+        exit(1);
+    if (! o.query_op.empty())
+        return query_mode(h, o);
+    if (o.info || o.dump_index)
+        return info_mode(h, o);
+    if (! o.time_mode.empty()) {
+        if      (o.time_mode == "absolute") h.timecol.mode = HPFFile::TimeColumn::absolute;
+        else if (o.time_mode == "relative") h.timecol.mode = HPFFile::TimeColumn::relative;
+        else if (o.time_mode == "epoch")    h.timecol.mode = HPFFile::TimeColumn::epoch;
+        else { cerr << "*** --time must be absolute, relative or epoch" << endl; exit(1); }
+    }
+    if (o.downsample >= 0) {
+        if (o.downsample > std::numeric_limits<int16_t>::max()) { cerr << "*** --downsample is at most " << std::numeric_limits<int16_t>::max() << endl; exit(1); }
+        h.do_downsample = o.downsample > 1;
+        h.downsample_count = o.downsample > 1 ? o.downsample : 1;
+    }
+    if (! o.where.empty())
+        return where_mode(h, o);
+    if (o.lttb > 0)
+        return lttb_mode(h, o);
+    if (! o.samples.empty())
+        return samples_mode(h, o);
+    if (! o.corr.empty())
+        return corr_mode(h, o);
+    if (o.sink_mode())
+        return sink_mode(h, o);
+    return table_mode(h, o);
+}
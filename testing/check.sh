@@ -0,0 +1,200 @@
+#!/bin/sh
+# make check: run hpf over small synthetic files written by testing/mkhpf, and compare what it prints
+# with what those files must give.  Each check prints ok or FAIL; the exit status is the number failed
+
+HPF=${HPF:-./hpf}
+MK=${MK:-testing/mkhpf}
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+fails=0
+
+check()
+{   # check NAME COMMAND...: COMMAND succeeds
+    name=$1; shift
+    if "$@" > "$T/out" 2>&1; then echo "ok   $name"; else echo "FAIL $name"; sed 's/^/     /' "$T/out" | head -20; fails=$((fails + 1)); fi
+}
+
+field()
+{   # field FILE KEY: the value of 'KEY :<tab>value' in hpf --info output
+    awk -F'\t' -v k="$2 :" '$1 == k { print $2 }' "$1"
+}
+
+$MK "$T/plain.hpf" || exit 1
+$MK --gap 500 --flat "$T/gap.hpf" || exit 1
+
+# table and metadata
+check "table rows"        sh -c "$HPF --no-sidecar $T/plain.hpf | wc -l | grep -qx 9"
+$HPF --no-sidecar --info "$T/plain.hpf" > "$T/info"
+check "info samples"      test "$(field "$T/info" TotalSamples)" = 8000
+check "info index"        test "$(field "$T/info" IndexSource)" = chunk
+
+# != keeps every row but those ==, with and without zone maps
+rows()
+{   # rows FILE EXPR [OPTIONS...]: the number of rows --where EXPR keeps
+    f=$1; e=$2; shift 2
+    $HPF --downsample 1 "$@" --where "$e" "$f" | tail -n +2 | wc -l
+}
+check "where: !="         test $(( $(rows "$T/plain.hpf" 'Ch0 == 0' --no-sidecar) + $(rows "$T/plain.hpf" 'Ch0 != 0' --no-sidecar) )) = 8000
+cp "$T/plain.hpf" "$T/zm.hpf"
+$HPF --info --zonemap "$T/zm.hpf" > /dev/null
+check "where: != zonemap" test "$(rows "$T/zm.hpf" 'Ch0 != 0')" = "$(rows "$T/plain.hpf" 'Ch0 != 0' --no-sidecar)"
+
+# a damaged .hpfidx sidecar is ignored whole: truncated in the zone maps, or with an index count beyond its size
+$MK "$T/side.hpf" || exit 1
+$HPF --info --zonemap "$T/side.hpf" > /dev/null
+cp "$T/side.hpfidx" "$T/good.hpfidx"
+head -c -10 "$T/good.hpfidx" > "$T/side.hpfidx"
+$HPF --info "$T/side.hpf" > "$T/info"
+check "sidecar: truncated"    test "$(field "$T/info" IndexEntries)" = 8
+cp "$T/good.hpfidx" "$T/side.hpfidx"
+at=$(grep -obUa chunk "$T/side.hpfidx" | tail -1 | cut -d: -f1)
+printf '\000\000\000\000\000\000\000\020' | dd of="$T/side.hpfidx" bs=1 seek=$((at + 5)) conv=notrunc 2> /dev/null
+$HPF --info "$T/side.hpf" > "$T/info" 2>&1
+check "sidecar: bad count"    test "$(field "$T/info" IndexEntries)" = 8
+
+# index rebuilt by scanning chunk headers in four ranges, with a decoy chunk header where the second range starts,
+# and in as many ranges as there are chunks or more
+$MK --chans 1 --chunks 40 "$T/indexed.hpf" || exit 1
+$MK --chans 1 --chunks 40 --noindex --decoy "$T/decoy.hpf" || exit 1
+$MK --chans 1 --chunks 40 --noindex "$T/noindex.hpf" || exit 1
+$HPF --no-sidecar --index "$T/indexed.hpf" > "$T/index"
+check "scan: decoy header"    sh -c "$HPF --no-sidecar --index --threads 4 $T/decoy.hpf | cmp -s - $T/index"
+for t in 1 3 40 100; do
+    check "scan: $t threads"  sh -c "$HPF --no-sidecar --index --threads $t $T/noindex.hpf | cmp -s - $T/index"
+done
+
+# every mode reading through sinks runs to the end of a file with a gap
+for m in "--trigger Ch0 1 --pre 50 --post 50" "--psd all --nfft 256 --block 700" "--tones 50 --channels 0" "--qc" \
+         "--compress swingingdoor --tolerance 0.1" "--align zoh" "--rolling mean,std --window 300" "--spikes all"; do
+    check "gap: $m"       sh -c "$HPF --no-sidecar $m $T/gap.hpf > /dev/null"
+done
+
+# trigger windows hold no sample from inside the gap, readings 2000 to 2499, and none twice
+$HPF --no-sidecar --trigger Ch0 1 --pre 50 --post 50 "$T/gap.hpf" | tail -n +2 | cut -f2 > "$T/samples"
+check "trigger: gap"      test "$(awk '$1 >= 2000 && $1 < 2500' "$T/samples" | wc -l)" = 0
+check "trigger: once"     test "$(sort -n "$T/samples" | uniq -d | wc -l)" = 0
+
+# spectrogram blocks stay on the 700-reading grid of the first across the gap, each once
+$HPF --no-sidecar --psd 0 --nfft 256 --block 700 "$T/gap.hpf" | tail -n +2 | cut -f1 | uniq > "$T/blocks"
+check "psd: block grid"   test "$(tr '\n' ' ' < "$T/blocks")" = "0 0.7 1.4 2.1 2.8 3.5 4.2 4.9 5.6 6.3 7 7.7 "
+# blocks shorter than nfft are counted in one line at the end, not warned about one by one
+$HPF --no-sidecar --psd 0 --nfft 512 --block 300 "$T/gap.hpf" > /dev/null 2> "$T/err"
+check "psd: short blocks" test "$(wc -l < "$T/err")" = 1
+
+# flat runs report the reading held, 1234 and 777 counts of 0.0003 V
+$HPF --no-sidecar --qc --flat 300 "$T/gap.hpf" | awk -F'\t' '$1 == "flat" { print $3, $4, $5 }' > "$T/flat"
+check "qc: flat runs"     test "$(tr '\n' ' ' < "$T/flat")" = "3833 333 0.3702 4166 334 0.2331 "
+
+# aligned output restarts at the time after the gap, 2.5 s, rather than numbering on from before it
+$MK --multirate --gap 500 "$T/mrgap.hpf" || exit 1
+$HPF --no-sidecar --downsample 1 --align linear --time relative "$T/mrgap.hpf" | tail -n +2 | cut -f1 > "$T/times"
+check "align: gap"        test "$(awk '$1 >= 1.998 && $1 < 2.5' "$T/times" | wc -l)-$(grep -c '^2.500$' "$T/times")" = 0-1
+
+# sinks reading every channel by datastartindex refuse channels at different rates
+$MK --multirate "$T/multi.hpf" || exit 1
+for m in "--qc" "--compress swingingdoor --tolerance 0.1" "--trigger Ch0 1" "--psd all" "--tones 50" "--rolling mean --window 10"; do
+    check "rates: $m"     sh -c "! $HPF --no-sidecar $m $T/multi.hpf > /dev/null 2> $T/err && grep -q 'different rate' $T/err"
+done
+# a filter on a slower channel is refused before its rows are read, even when the output is aligned
+check "rates: --where"    sh -c "! $HPF --no-sidecar --where 'Ch1 > -1' --align linear $T/multi.hpf > /dev/null 2> $T/err && grep -q 'Ch1 has fewer readings' $T/err"
+
+# thermocouple types are matched by name: "Type K" is K, "None" is no type and stays in volts
+$MK --tctype K "$T/k.hpf" && $MK --tctype "Type K" "$T/typek.hpf" && $MK --tctype None "$T/none.hpf" || exit 1
+$HPF --no-sidecar --units eng "$T/k.hpf" > "$T/k"
+check "tc: Type K"        sh -c "$HPF --no-sidecar --units eng $T/typek.hpf | cmp -s - $T/k"
+$HPF --no-sidecar "$T/none.hpf" | cut -f3 > "$T/volts"
+check "tc: None"          sh -c "$HPF --no-sidecar --units eng $T/none.hpf 2> /dev/null | cut -f3 | cmp -s - $T/volts"
+
+# rolling std of a thermocouple channel, converted by table, agrees with a two-pass std of the table's values
+$HPF --no-sidecar --units eng --downsample 1 "$T/k.hpf" | tail -n +2 | cut -f3 > "$T/kv"
+$HPF --no-sidecar --units eng --rolling mean,std --window 50 --hop 1 --channels 2 "$T/k.hpf" | tail -n +2 > "$T/roll"
+check "rolling: table std" sh -c "awk 'NR == FNR { v[NR - 1] = \$1; next }
+    \$3 != \"nan\" { m = q = 0; for (k = \$1 - 49; k <= \$1; ++k) m += v[k]; m /= 50
+                     for (k = \$1 - 49; k <= \$1; ++k) q += (v[k] - m) ^ 2
+                     e = sqrt(q / 50) - \$4; if (e * e > 1e-18) bad++; n++ }
+    END { exit n < 1000 || bad }' $T/kv $T/roll"
+
+# --qc --step is in output units, degrees for a thermocouple channel, counted the same from the table's values
+$HPF --no-sidecar --units eng --qc --step 20 "$T/k.hpf" | awk -F'\t' '$1 == "Ch2" { print $6 }' > "$T/steps"
+check "qc: table step"    test "$(cat "$T/steps")" = "$(awk 'NR > 1 && $1 != "nan" && p != "nan" { d = $1 - p; if (d < 0) d = -d; if (d >= 20) n++ }
+    { p = $1 } END { print n + 0 }' "$T/kv")"
+
+# --compress tolerances are in output units too: every reading stays within 40 degrees of the last point written
+$HPF --no-sidecar --units eng --compress deadband --tolerance Ch2=40 "$T/k.hpf" | awk -F'\t' '$3 == "Ch2" { print $1, $4 }' > "$T/kc"
+check "compress: table"   awk 'NR == FNR { w[$1] = $2; next } { t = FNR - 1; if (t in w) v = w[t] }
+    $1 != "nan" && v != "nan" { d = $1 - v; if (d < 0) d = -d; if (d > 40) bad++; n++ } END { exit n < 1000 || bad }' "$T/kc" "$T/kv"
+
+# correlation of a file with no data chunks says so rather than reading empty co-moments
+$MK --chunks 0 "$T/empty.hpf" || exit 1
+check "corr: no readings" sh -c "$HPF --no-sidecar --corr all $T/empty.hpf 2>&1 | grep -q 'no readings'"
+
+# chunks of no readings leave filter and derived columns empty (caught by builds with _GLIBCXX_ASSERTIONS)
+$MK --n 0 "$T/zero.hpf" || exit 1
+check "rows: no readings" test "$($HPF --no-sidecar --derive 'S = Ch0 + Ch1' --where 'Ch0 > 0' "$T/zero.hpf")" = "$(printf 'Ch0\tCh1\tCh2\tS')"
+
+# spikes on a channel at half the rate are listed at its own reading numbers and times: reading 100 of each
+# chunk is sample 500 c + 100 at 0.002 s a reading
+$MK --multirate --spike "$T/spiky.hpf" || exit 1
+$HPF --no-sidecar --spikes all "$T/spiky.hpf" | awk -F'\t' '$3 == "Ch1"' > "$T/spikes"
+check "spikes: own rate"  sh -c "test \$(awk -F'\t' '\$1 % 500 == 100 && \$2 == \$1 / 500' $T/spikes | wc -l) = 8"
+
+# diff: a thermocouple reading in range in one file and beyond it, NaN, in the other differs, without
+# making the largest error NaN
+$MK --tctype K --spike "$T/kspike.hpf" || exit 1
+$HPF diff --no-sidecar --units eng "$T/k.hpf" "$T/kspike.hpf" | awk -F'\t' '$1 == "Ch2" && NF == 8' > "$T/diff"
+check "diff: NaN error"   test "$(cut -f3,5 "$T/diff")" = "$(printf '8\t0')"
+
+# the server closes a connection idle past --idle, so an idle client does not hold off the next
+if command -v python3 > /dev/null; then
+    $HPF serve --idle 1 "$T/sock" & server=$!
+    sleep 0.5
+    python3 -c "import socket, time; s = socket.socket(socket.AF_UNIX); s.connect('$T/sock'); time.sleep(5)" & idler=$!
+    sleep 0.3
+    check "serve: idle client" sh -c "timeout 4 $HPF ask $T/sock $T/plain.hpf --end 3 | wc -l | grep -qx 4"
+    kill $server $idler 2> /dev/null
+    wait $server $idler 2> /dev/null
+fi
+
+# a ring reader started before the writer sees the header once it is ready, then every reading
+ring=hpfcheck$$
+$HPF ring --from-start $ring > "$T/ring" & reader=$!
+sleep 0.3
+$HPF --no-sidecar --shm $ring --shm-block 300 "$T/plain.hpf"
+wait $reader
+$HPF --no-sidecar --downsample 1 "$T/plain.hpf" > "$T/table"
+check "ring: readings"    sh -c "cut -f2- $T/ring | cmp -s - $T/table"
+rm -f /dev/shm/$ring
+
+# hpf summary (make STD=c++20, or make check20) gives the means of the table's readings, leaving out NaN
+if ! $HPF summary 2>&1 | grep -q 'needs C++20'; then
+    for f in plain k; do
+        $HPF --no-sidecar --units eng --downsample 1 "$T/$f.hpf" | tail -n +2 > "$T/table"
+        $HPF summary --no-sidecar --units eng "$T/$f.hpf" | tail -n +2 | cut -f3,4 > "$T/summary"
+        check "summary: $f means" sh -c "awk -F'\t' 'NR == FNR { for (j = 1; j <= NF; ++j) if (\$j != \"nan\") { s[j] += \$j; n[j]++ }; next }
+            { m = s[FNR] / n[FNR]; d = m - \$2; if (\$1 != n[FNR] || d * d > 1e-18 * (m * m + 1)) bad++ }
+            END { exit FNR != 3 || bad }' $T/table $T/summary"
+    done
+fi
+
+# --read-ahead changes how chunks are read, not what is output, in file order or through the index
+$HPF --no-sidecar --downsample 1 "$T/gap.hpf" > "$T/table"
+$HPF --no-sidecar --downsample 1 --where 'Ch0 > 1' "$T/gap.hpf" > "$T/where"
+check "read-ahead: table" sh -c "$HPF --no-sidecar --downsample 1 --read-ahead 4 $T/gap.hpf | cmp -s - $T/table"
+check "read-ahead: where" sh -c "$HPF --no-sidecar --downsample 1 --read-ahead 4 --where 'Ch0 > 1' $T/gap.hpf | cmp -s - $T/where"
+
+# a chunk cut short by the end of the file is dropped by either reader, not decoded from stale bytes
+$MK --noindex "$T/cut.hpf" || exit 1
+head -c $(( $(wc -c < "$T/cut.hpf") - 3000 )) "$T/cut.hpf" > "$T/short.hpf"
+$HPF --no-sidecar --downsample 1 "$T/short.hpf" > "$T/short" 2> /dev/null
+check "read-ahead: short" sh -c "test \$(wc -l < $T/short) = 7001 && $HPF --no-sidecar --downsample 1 --read-ahead 4 $T/short.hpf 2> /dev/null | cmp -s - $T/short"
+
+# a channel descriptor pointing past its chunk, read through the index beside the main reader, is reported
+cp "$T/plain.hpf" "$T/baddesc.hpf"
+at=$(( $($HPF --no-sidecar --index "$T/baddesc.hpf" | head -1 | sed 's/.*fileoffset=//') + 48 ))  # Ch2's offset
+printf '\000\377\377\177' | dd of="$T/baddesc.hpf" bs=1 seek=$at conv=notrunc 2> /dev/null
+for m in "--samples 0:10 --channels Ch2" "--corr Ch2"; do
+    check "chunk bounds: $m" sh -c "! $HPF --no-sidecar $m $T/baddesc.hpf > /dev/null 2> $T/err && grep -q 'Ch2 missing' $T/err"
+done
+
+echo "$fails failed"
+exit $fails
@@ -0,0 +1,184 @@
+// mkhpf writes small synthetic HPF files for make check: one channel group of Int16 channels carrying
+// noisy sine waves, in data chunks of a fixed length, optionally with a gap in datastartindex, a slower
+// channel, a flat run, a thermocouple channel with some readings beyond its range, spikes, no index chunk,
+// and a decoy: bytes in the data a quarter of the way through the file that look like two chained chunk headers
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+using namespace std;
+
+struct Options {
+    string  out;
+    int32_t chans     = 3;
+    int32_t chunks    = 8;
+    int32_t n         = 1000;   // readings per channel per chunk
+    int64_t first     = 0;      // datastartindex of the first chunk
+    int64_t gap       = 0;      // readings skipped before the third chunk
+    bool    noindex   = false;
+    bool    tc        = false;  // last channel is a thermocouple
+    string  tctype    = "K";    // its ThermocoupleType
+    bool    multirate = false;  // channel 1 runs at half the rate
+    bool    flat      = false;  // channel 2 holds still for the middle third of the fourth chunk
+    bool    decoy     = false;
+    bool    spike     = false;  // reading 100 of every chunk on every channel jumps to the far end of the range
+    unsigned seed     = 1;
+};
+
+static void put(string& b, const void* p, const size_t n) { b.append(static_cast<const char*>(p), n); }
+template<typename T> static void put(string& b, const T v) { put(b, &v, sizeof(v)); }
+
+static string chunk(const int64_t id, const string& body)
+{
+    int64_t size = 16 + body.size();
+    size += (8 - size % 8) % 8;
+    string c;
+    put(c, id);
+    put(c, size);
+    c += body;
+    c.resize(size, '\0');
+    return c;
+}
+
+static string chinfo(const Options& o, const int32_t i)
+{
+    bool tc = o.tc && i == o.chans - 1;
+    double rate = (o.multirate && i == 1) ? 500.0 : 1000.0;
+    stringstream ss;
+    ss.precision(17);
+    ss << "<ChannelInformation><Name>Ch" << i << "</Name><Unit>V</Unit><ChannelType>RandomDataChannel</ChannelType>"
+        << "<AssignedTimeChannelIndex>0</AssignedTimeChannelIndex><DataType>Int16</DataType><DataIndex>" << i << "</DataIndex>"
+        << "<StartTime>2020-01-02 03:04:05.000</StartTime><TimeIncrement>" << 1.0 / rate << "</TimeIncrement>"
+        << "<RangeMin>-32768</RangeMin><RangeMax>32767</RangeMax><DataScale>0.0003</DataScale><DataOffset>0</DataOffset>"
+        << "<SensorScale>2</SensorScale><SensorOffset>1</SensorOffset><PerChannelSampleRate>" << rate << "</PerChannelSampleRate>"
+        << "<PhysicalChannelNumber>" << i << "</PhysicalChannelNumber><UsesSensorValues>True</UsesSensorValues>"
+        << "<ThermocoupleType>" << (tc ? o.tctype : "None") << "</ThermocoupleType><TemperatureUnit>C</TemperatureUnit>"
+        << "<UseThermocoupleValues>" << (tc ? "True" : "False") << "</UseThermocoupleValues></ChannelInformation>";
+    return ss.str();
+}
+
+int main(int argc, char* argv[])
+{
+    Options o;
+    for (auto i = 1; i < argc; ++i) {
+        string a(argv[i]);
+        if      (a == "--chans" && i + 1 < argc)  o.chans = atol(argv[++i]);
+        else if (a == "--chunks" && i + 1 < argc) o.chunks = atol(argv[++i]);
+        else if (a == "--n" && i + 1 < argc)      o.n = atol(argv[++i]);
+        else if (a == "--first" && i + 1 < argc)  o.first = atoll(argv[++i]);
+        else if (a == "--gap" && i + 1 < argc)    o.gap = atoll(argv[++i]);
+        else if (a == "--seed" && i + 1 < argc)   o.seed = atol(argv[++i]);
+        else if (a == "--noindex")                o.noindex = true;
+        else if (a == "--tc")                     o.tc = true;
+        else if (a == "--tctype" && i + 1 < argc) { o.tc = true; o.tctype = argv[++i]; }
+        else if (a == "--multirate")              o.multirate = true;
+        else if (a == "--flat")                   o.flat = true;
+        else if (a == "--decoy")                  o.decoy = true;
+        else if (a == "--spike")                  o.spike = true;
+        else if (a[0] != '-' && o.out.empty())    o.out = a;
+        else { cerr << "Usage: mkhpf [--chans N] [--chunks N] [--n N] [--first S] [--gap N] [--seed N] "
+                       "[--noindex] [--tc] [--tctype NAME] [--multirate] [--flat] [--decoy] [--spike] out.hpf" << endl; return 1; }
+    }
+    if (o.out.empty()) { cerr << "mkhpf: no output file" << endl; return 1; }
+    mt19937 rng(o.seed);
+    uniform_int_distribution<int> noise(-200, 200), tcnoise(-3, 3);
+
+    const string hdrxml = "<RecordingDate>2020-01-02 03:04:05.000</RecordingDate>";
+    auto header = [&hdrxml](const int64_t indexoffset) {
+        string b;
+        put(b, int32_t(0x78746164));  // 'datx'
+        put(b, int64_t(1));
+        put(b, indexoffset);
+        b += hdrxml;
+        b += '\0';
+        return chunk(0x1000, b);
+    };
+    string f = header(0);
+    string xml = "<ChannelInformationData>";
+    for (auto i = 0; i < o.chans; ++i)
+        xml += chinfo(o, i);
+    xml += "</ChannelInformationData>";
+    string b;
+    put(b, int32_t(0));
+    put(b, o.chans);
+    b += xml;
+    b += '\0';
+    f += chunk(0x2000, b);
+
+    vector<int64_t> index;  // datastartindex, readings, chunkid, groupid, fileoffset for each data chunk
+    int64_t dsi = o.first;
+    for (auto c = 0; c < o.chunks; ++c) {
+        if (c == 2)
+            dsi += o.gap;
+        vector<vector<int16_t>> cols(o.chans);
+        for (auto i = 0; i < o.chans; ++i) {
+            int32_t m = (o.multirate && i == 1) ? o.n / 2 : o.n;
+            for (auto k = 0; k < m; ++k) {
+                int64_t s = dsi + k;
+                int v;
+                if (o.flat && i == 2 && c == 3 && k >= o.n / 3)
+                    v = k < 2 * o.n / 3 ? 1234 : 777;
+                else if (o.tc && i == o.chans - 1)  // 0.0003 V counts, about 9 mV, and every 97th reading far out of range
+                    v = s % 97 == 0 ? 1000 : 30 + static_cast<int>(10 * sin(s / 37.0)) + tcnoise(rng);
+                else
+                    v = static_cast<int>(8000 * sin(2 * M_PI * 50 * s / 1000.0 + i)) + noise(rng) + 1000 * i;
+                if (o.spike && k == 100)
+                    v = v < 0 ? 32000 : -32000;
+                cols[i].push_back(v);
+            }
+        }
+        string d, descs, data;
+        put(d, int32_t(0));
+        put(d, dsi);
+        put(d, o.chans);
+        int32_t off = 32 + 8 * o.chans;
+        for (auto& col : cols) {
+            int32_t len = col.size() * sizeof(int16_t);
+            put(descs, off);
+            put(descs, len);
+            put(data, col.data(), len);
+            off += len;
+        }
+        for (auto v : { dsi, int64_t(o.n), int64_t(0x3000), int64_t(0), int64_t(f.size()) })
+            index.push_back(v);
+        f += chunk(0x3000, d + descs + data);
+        dsi += o.n;
+    }
+    if (o.decoy) {  // inside the data chunk holding the quarter point, from there or past its header
+        int64_t q = f.size() / 4;
+        for (size_t e = 0; e < index.size(); e += 5) {
+            int64_t off = index[e + 4], size = 32 + 8 * o.chans + 2 * o.n * o.chans;
+            if (off <= q && q < off + size) {
+                int64_t at = std::max(q, off + 64);
+                if (at + 0x110 > off + size)
+                    break;
+                string h;
+                put(h, int64_t(0x3000));
+                put(h, int64_t(0x100));
+                f.replace(at, h.size(), h);
+                f.replace(at + 0x100, h.size(), h);
+                break;
+            }
+        }
+    }
+    if (! o.noindex) {
+        int64_t indexoffset = f.size();
+        string x;
+        put(x, int64_t(index.size() / 5));
+        put(x, index.data(), index.size() * sizeof(int64_t));
+        f += chunk(0x6000, x);
+        f.replace(0, header(0).size(), header(indexoffset));
+    }
+    ofstream out(o.out, ios::binary);
+    out.write(f.data(), f.size());
+    return out ? 0 : 1;
+}